@@ -31,13 +31,19 @@
  */
 
 #include <view/mainwindow.h>
+#include <util/IlmThreadProvider.h>
+#include <util/ThreadPool.h>
 #include <config.h>
 #include <QApplication>
 #include <QFile>
 
+#include <cstdio>
+
 #if defined(WIN32)
 
 #    include <Windows.h>
+#    include <fcntl.h>
+#    include <io.h>
 
 int CALLBACK WinMain(
   _In_ HINSTANCE /*hInstance*/,
@@ -65,15 +71,22 @@ int main(int argc, char* argv[])
         a.setStyleSheet(ts.readAll());
     }
 
+    // OpenEXR shares the viewer's threads, the pool takes the ownership
+    IlmThread::ThreadPool::globalThreadPool().setThreadProvider(
+      new IlmThreadProvider(ThreadPool::globalPool()));
+
     MainWindow w;
     w.show();
 
     if (argc > 1) {
         if (strcmp(argv[1], "--") == 0) {
-            std::cerr << "Reading from stdin not yet supported." << std::endl;
-            exit(1);
             // Read from stdin
-            w.open(std::cin);
+#if defined(WIN32)
+            _setmode(_fileno(stdin), _O_BINARY);
+            w.open(_fileno(stdin));
+#else
+            w.open(fileno(stdin));
+#endif
         } else {
             for (int i = 1; i < argc; i++) {
                 w.open(argv[i]);
@@ -0,0 +1,315 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "FileIStream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#    define NOMINMAX
+#    include <Windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+FileIStream::FileIStream(const QString& filename, bool mapped)
+  : IStream(filename.toStdString().c_str())
+#ifdef _WIN32
+  , m_handle(INVALID_HANDLE_VALUE)
+  , m_mapping(nullptr)
+#else
+  , m_fd(-1)
+#endif
+  , m_size(0)
+  , m_position(0)
+  , m_data(nullptr)
+{
+#ifdef _WIN32
+    // Other processes may still write, rename or delete the file
+    m_handle = CreateFileW(
+      reinterpret_cast<LPCWSTR>(filename.utf16()),
+      GENERIC_READ,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      nullptr,
+      OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr);
+
+    if (m_handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open file " + std::string(fileName()));
+    }
+
+    LARGE_INTEGER size;
+
+    if (
+      GetFileType(m_handle) != FILE_TYPE_DISK
+      || !GetFileSizeEx(m_handle, &size)) {
+        CloseHandle(m_handle);
+        throw std::runtime_error(
+          "Not a regular file " + std::string(fileName()));
+    }
+
+    m_size = size.QuadPart;
+#else
+    m_fd = ::open(filename.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+
+    if (m_fd < 0) {
+        throw std::runtime_error(
+          "Cannot open file " + std::string(fileName()) + ": "
+          + std::strerror(errno));
+    }
+
+    struct stat status;
+
+    if (fstat(m_fd, &status) != 0 || !S_ISREG(status.st_mode)) {
+        ::close(m_fd);
+        throw std::runtime_error(
+          "Not a regular file " + std::string(fileName()));
+    }
+
+    m_size = status.st_size;
+#endif
+
+    if (mapped && m_size > 0) {
+        map();
+    }
+}
+
+
+FileIStream::FileIStream(const char filename[], uint64_t size)
+  : IStream(filename)
+#ifdef _WIN32
+  , m_handle(INVALID_HANDLE_VALUE)
+  , m_mapping(nullptr)
+#else
+  , m_fd(-1)
+#endif
+  , m_size(size)
+  , m_position(0)
+  , m_data(nullptr)
+{}
+
+
+FileIStream::~FileIStream()
+{
+#ifdef _WIN32
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+
+    CloseHandle(m_handle);
+#else
+    if (m_data) {
+        munmap(m_data, (size_t)m_size);
+    }
+
+    ::close(m_fd);
+#endif
+}
+
+
+FileIStream* FileIStream::duplicate() const
+{
+    FileIStream* stream = new FileIStream(fileName(), m_size);
+
+#ifdef _WIN32
+    const bool duplicated = DuplicateHandle(
+      GetCurrentProcess(),
+      m_handle,
+      GetCurrentProcess(),
+      &stream->m_handle,
+      0,
+      FALSE,
+      DUPLICATE_SAME_ACCESS);
+#else
+    stream->m_fd          = fcntl(m_fd, F_DUPFD_CLOEXEC, 0);
+    const bool duplicated = stream->m_fd >= 0;
+#endif
+
+    if (!duplicated) {
+        delete stream;
+        throw std::runtime_error(
+          "Cannot duplicate file " + std::string(fileName()));
+    }
+
+    return stream;
+}
+
+
+bool FileIStream::isSameFile(const FileIStream& other) const
+{
+#ifdef _WIN32
+    BY_HANDLE_FILE_INFORMATION info, otherInfo;
+
+    if (
+      !GetFileInformationByHandle(m_handle, &info)
+      || !GetFileInformationByHandle(other.m_handle, &otherInfo)) {
+        return true;
+    }
+
+    return info.dwVolumeSerialNumber == otherInfo.dwVolumeSerialNumber
+           && info.nFileIndexHigh == otherInfo.nFileIndexHigh
+           && info.nFileIndexLow == otherInfo.nFileIndexLow;
+#else
+    struct stat status, otherStatus;
+
+    if (fstat(m_fd, &status) != 0 || fstat(other.m_fd, &otherStatus) != 0) {
+        return true;
+    }
+
+    return status.st_dev == otherStatus.st_dev
+           && status.st_ino == otherStatus.st_ino;
+#endif
+}
+
+
+void FileIStream::map()
+{
+    // The positional reads are used when the file cannot be mapped
+#ifdef _WIN32
+    m_mapping
+      = CreateFileMappingW(m_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (m_mapping) {
+        m_data = (char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    void* data
+      = mmap(nullptr, (size_t)m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+
+    if (data != MAP_FAILED) {
+        m_data = (char*)data;
+    }
+#endif
+}
+
+
+char* FileIStream::readMemoryMapped(int n)
+{
+    if (n < 0) {
+        throw std::runtime_error("Invalid read size");
+    }
+
+    if (m_position + n > m_size) {
+        throw std::runtime_error(
+          "Unexpected end of file " + std::string(fileName()));
+    }
+
+    char* data = m_data + m_position;
+    m_position += n;
+
+    return data;
+}
+
+
+bool FileIStream::read(char c[], int n)
+{
+    if (n < 0) {
+        throw std::runtime_error("Invalid read size");
+    }
+
+    if (m_data) {
+        std::memcpy(c, readMemoryMapped(n), n);
+
+        return m_position < m_size;
+    }
+
+    int done = 0;
+
+    // Reads at the position of the stream, which may return fewer bytes
+    // than requested
+    while (done < n) {
+        const uint64_t offset = m_position + done;
+
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+        overlapped.Offset     = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        DWORD count = 0;
+
+        if (
+          !ReadFile(m_handle, c + done, n - done, &count, &overlapped)
+          && GetLastError() != ERROR_HANDLE_EOF) {
+            throw std::runtime_error(
+              "Cannot read file " + std::string(fileName()));
+        }
+#else
+        const ssize_t count = pread(m_fd, c + done, n - done, (off_t)offset);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            throw std::runtime_error(
+              "Cannot read file " + std::string(fileName()) + ": "
+              + std::strerror(errno));
+        }
+#endif
+
+        // The file may have been truncated since it was opened
+        if (count == 0) {
+            throw std::runtime_error(
+              "Unexpected end of file " + std::string(fileName()));
+        }
+
+        done += count;
+    }
+
+    m_position += n;
+
+    return m_position < m_size;
+}
+
+
+uint64_t FileIStream::tellg()
+{
+    return m_position;
+}
+
+
+void FileIStream::seekg(uint64_t pos)
+{
+    m_position = pos;
+}
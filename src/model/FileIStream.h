@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <OpenEXR/ImfIO.h>
+
+#include <QString>
+
+#include <cstdint>
+
+// Input stream reading a local file.
+//
+// By default the file is read with positional reads: a renderer rewriting
+// it in place only makes the reads fail with an exception, and it can still
+// be replaced while it is opened. A mapped stream saves OpenEXR a copy per
+// chunk, but truncating the file while it is read crashes the viewer with
+// SIGBUS and, on Windows, the file cannot be replaced while it is mapped.
+// Only files which are neither watched nor being written should be mapped.
+class FileIStream: public Imf::IStream
+{
+  public:
+    // Throws if the file cannot be opened or is not a regular file e.g.,
+    // pipes or special files
+    FileIStream(const QString& filename, bool mapped = false);
+    virtual ~FileIStream();
+
+    FileIStream(const FileIStream&) = delete;
+    FileIStream& operator=(const FileIStream&) = delete;
+
+    // New stream reading the same file, even if it was replaced since, with
+    // its own position e.g., for another thread. It is not mapped.
+    FileIStream* duplicate() const;
+
+    // Both streams read the same file, not two versions of it. Assumed
+    // when it cannot be told.
+    bool isSameFile(const FileIStream& other) const;
+
+    virtual bool  isMemoryMapped() const { return m_data != nullptr; }
+    virtual char* readMemoryMapped(int n);
+
+    // Returns false once the last byte of the file is read
+    virtual bool     read(char c[/*n*/], int n);
+    virtual uint64_t tellg();
+    virtual void     seekg(uint64_t pos);
+
+  private:
+    // The file is set by duplicate()
+    FileIStream(const char filename[], uint64_t size);
+
+    void map();
+
+#ifdef _WIN32
+    void* m_handle;
+    void* m_mapping;
+#else
+    int m_fd;
+#endif
+    uint64_t m_size;
+    uint64_t m_position;
+
+    // Content of the file when it is mapped, null otherwise
+    char* m_data;
+};
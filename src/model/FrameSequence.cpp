@@ -0,0 +1,114 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "FrameSequence.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+
+#include <algorithm>
+
+FrameSequence::FrameSequence(const QString& filename)
+  : m_startIndex(0)
+{
+    const QFileInfo info(filename);
+
+    m_frames.append({0, filename});
+    m_pattern = info.fileName();
+
+    // The frame number is the last group of digits before the extension
+    const QRegularExpressionMatch match
+      = QRegularExpression("^(.*?)(\\d+)(\\.[^.]+)$")
+          .match(info.fileName());
+
+    if (!match.hasMatch()) {
+        return;
+    }
+
+    const QString prefix = match.captured(1);
+    const QString digits = match.captured(2);
+    const QString suffix = match.captured(3);
+
+    const QRegularExpression framePattern(
+      "^" + QRegularExpression::escape(prefix) + "(\\d+)"
+      + QRegularExpression::escape(suffix) + "$");
+
+    const QDir        folder = info.absoluteDir();
+    const QStringList names  = folder.entryList(
+      QStringList() << prefix + "*" + suffix,
+      QDir::Files | QDir::Readable);
+
+    QVector<Frame> frames;
+
+    for (const QString& name : names) {
+        const QRegularExpressionMatch frameMatch = framePattern.match(name);
+
+        if (!frameMatch.hasMatch()) {
+            continue;
+        }
+
+        const QString number = frameMatch.captured(1);
+
+        // Padded numbers have the same number of digits, others have no
+        // leading zero
+        if (
+          number.size() != digits.size()
+          && (number.startsWith('0') || digits.startsWith('0'))) {
+            continue;
+        }
+
+        frames.append({number.toInt(), folder.filePath(name)});
+    }
+
+    // The file itself may not be listed e.g., when it is not readable
+    if (frames.isEmpty()) {
+        return;
+    }
+
+    std::sort(
+      frames.begin(),
+      frames.end(),
+      [](const Frame& a, const Frame& b) { return a.number < b.number; });
+
+    const int frameNumber = digits.toInt();
+
+    for (int i = 0; i < frames.size(); i++) {
+        if (frames[i].number == frameNumber) {
+            m_startIndex = i;
+        }
+    }
+
+    m_frames  = frames;
+    m_pattern = prefix + QString(digits.size(), '#') + suffix;
+}
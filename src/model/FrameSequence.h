@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+// Files of an image sequence, named after a common pattern with a frame
+// number before the extension e.g., render.0001.exr, render.0002.exr...
+class FrameSequence
+{
+  public:
+    // Sequence the file belongs to, found in the folder of the file. The
+    // sequence only holds this file when its name has no frame number.
+    explicit FrameSequence(const QString& filename);
+
+    int size() const { return m_frames.size(); }
+
+    const QString& getFilename(int index) const
+    {
+        return m_frames[index].filename;
+    }
+
+    int getFrameNumber(int index) const { return m_frames[index].number; }
+
+    // Index of the file the sequence was found from
+    int getStartIndex() const { return m_startIndex; }
+
+    // Name of the files with # in place of the frame number
+    QString getPattern() const { return m_pattern; }
+
+  private:
+    struct Frame
+    {
+        int     number;
+        QString filename;
+    };
+
+    QVector<Frame> m_frames;
+    int            m_startIndex;
+    QString        m_pattern;
+};
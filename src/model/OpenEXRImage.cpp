@@ -31,38 +31,98 @@
  */
 
 #include "OpenEXRImage.h"
+#include "FileIStream.h"
 #include "StdIStream.h"
 
+#include <util/ThreadPool.h>
+
 #include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/openexr.h>
 
 #include <Imath/ImathBox.h>
 
+#include <atomic>
+
 
 OpenEXRImage::OpenEXRImage(const QString& filename, QObject* parent)
   : QObject(parent)
   , m_filename(filename)
   , m_isStream(false)
-  , m_exrIn(new Imf::MultiPartInputFile(filename.toStdString().c_str()))
+  , m_stream(nullptr)
+  , m_exrIn(nullptr)
+  , m_coreContext(nullptr)
   , m_headerModel(nullptr)
   , m_layerModel(nullptr)
+  , m_prefetcher(m_channelCache)
 {
+    // Local files are read with positional reads, not mapped, since they are
+    // watched and may be rewritten while they are opened. Other files (e.g.,
+    // named pipes) are read by OpenEXR
+    try {
+        m_stream = new FileIStream(filename);
+    } catch (std::exception&) {
+        m_stream = nullptr;
+    }
+
+    try {
+        if (m_stream) {
+            m_exrIn = new Imf::MultiPartInputFile(*m_stream);
+        } else {
+            m_exrIn
+              = new Imf::MultiPartInputFile(filename.toStdString().c_str());
+        }
+    } catch (...) {
+        delete m_stream;
+        throw;
+    }
+
+    // The prefetcher reads the same file with its own stream
+    if (m_stream) {
+        try {
+            m_prefetcher.setStream(
+              static_cast<FileIStream*>(m_stream)->duplicate());
+        } catch (std::exception&) {
+        }
+    }
+
     m_headerModel = new HeaderModel(*m_exrIn, m_exrIn->parts(), this);
     m_headerModel->addFile(*m_exrIn, filename);
 
     m_layerModel = new LayerModel(*m_exrIn, this);
+
+    exr_context_initializer_t initializer = EXR_DEFAULT_CONTEXT_INITIALIZER;
+
+    if (
+      exr_start_read(
+        &m_coreContext,
+        filename.toStdString().c_str(),
+        &initializer)
+      != EXR_ERR_SUCCESS) {
+        m_coreContext = nullptr;
+    }
+
+    readChunkTables();
 }
 
 
-OpenEXRImage::OpenEXRImage(std::istream& stream, QObject* parent)
+OpenEXRImage::OpenEXRImage(int fd, QObject* parent)
   : QObject(parent)
   , m_isStream(true)
-  //  , m_exrIn(StdIStream(stream))
+  , m_stream(new StdIStream(fd))
+  , m_exrIn(nullptr)
+  , m_coreContext(nullptr)
   , m_headerModel(nullptr)
   , m_layerModel(nullptr)
+  , m_prefetcher(m_channelCache)
 {
-    StdIStream s(stream);
-    m_exrIn = new Imf::MultiPartInputFile(s);
+    // The stream is kept alive: parts are read from it after the header
+    try {
+        m_exrIn = new Imf::MultiPartInputFile(*m_stream);
+    } catch (...) {
+        delete m_stream;
+        throw;
+    }
 
     m_headerModel = new HeaderModel(*m_exrIn, m_exrIn->parts(), this);
     m_headerModel->addFile(*m_exrIn, "Stream");
@@ -73,7 +133,226 @@ OpenEXRImage::OpenEXRImage(std::istream& stream, QObject* parent)
 
 OpenEXRImage::~OpenEXRImage()
 {
+    m_prefetcher.stop();
+
     delete m_headerModel;
     delete m_layerModel;
     delete m_exrIn;
+    delete m_stream;
+
+    if (m_coreContext) {
+        exr_finish(&m_coreContext);
+    }
+}
+
+
+bool OpenEXRImage::hasSamePart(const OpenEXRImage& other, int partId) const
+{
+    if (
+      partId < 0 || partId >= (int)m_chunkTables.size()
+      || partId >= (int)other.m_chunkTables.size()
+      || m_chunkTables[partId].empty()
+      || m_chunkTables[partId].size() != other.m_chunkTables[partId].size()) {
+        return false;
+    }
+
+    const Imf::Header& header      = m_exrIn->header(partId);
+    const Imf::Header& otherHeader = other.m_exrIn->header(partId);
+
+    if (
+      header.compression() != otherHeader.compression()
+      || header.channels() != otherHeader.channels()
+      || header.dataWindow() != otherHeader.dataWindow()
+      || header.displayWindow() != otherHeader.displayWindow()) {
+        return false;
+    }
+
+    // The previous version can only be read when the file was replaced
+    // rather than rewritten
+    if (m_isStream || other.m_isStream || !m_stream || !other.m_stream) {
+        return false;
+    }
+
+    const FileIStream& stream      = *static_cast<FileIStream*>(m_stream);
+    const FileIStream& otherStream = *static_cast<FileIStream*>(other.m_stream);
+
+    if (stream.isSameFile(otherStream)) {
+        return false;
+    }
+
+    const std::vector<exr_chunk_info_t>& chunks = m_chunkTables[partId];
+    const std::vector<exr_chunk_info_t>& otherChunks
+      = other.m_chunkTables[partId];
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (
+          chunks[i].data_offset != otherChunks[i].data_offset
+          || chunks[i].packed_size != otherChunks[i].packed_size
+          || chunks[i].sample_count_table_size
+               != otherChunks[i].sample_count_table_size) {
+            return false;
+        }
+    }
+
+    // Chunks keep their size whatever their pixels e.g., uncompressed or
+    // B44 ones: the content of the chunks is compared as well
+    exr_storage_t storage;
+    exr_get_storage(m_coreContext, partId, &storage);
+
+    const bool isDeep = storage == EXR_STORAGE_DEEP_SCANLINE
+                        || storage == EXR_STORAGE_DEEP_TILED;
+
+    std::atomic<bool> same(true);
+
+    ThreadPool::globalPool().parallelFor(
+      0,
+      chunks.size(),
+      [&](int64_t begin, int64_t end) {
+          std::vector<uint8_t> data, sampleCounts;
+          std::vector<uint8_t> otherData, otherSampleCounts;
+
+          for (int64_t i = begin; same && i < end; i++) {
+              if (
+                !readChunk(
+                  m_coreContext,
+                  partId,
+                  chunks[i],
+                  isDeep,
+                  data,
+                  sampleCounts)
+                || !readChunk(
+                  other.m_coreContext,
+                  partId,
+                  otherChunks[i],
+                  isDeep,
+                  otherData,
+                  otherSampleCounts)
+                || data != otherData || sampleCounts != otherSampleCounts) {
+                  same = false;
+              }
+          }
+      },
+      16);
+
+    return same;
+}
+
+
+bool OpenEXRImage::readChunk(
+  exr_const_context_t     context,
+  int                     partId,
+  const exr_chunk_info_t& chunk,
+  bool                    isDeep,
+  std::vector<uint8_t>&   data,
+  std::vector<uint8_t>&   sampleCounts)
+{
+    // Extra byte so empty chunks still have a buffer
+    data.resize(chunk.packed_size + 1);
+    sampleCounts.resize(isDeep ? chunk.sample_count_table_size + 1 : 0);
+
+    const exr_result_t result = isDeep
+      ? exr_read_deep_chunk(
+        context,
+        partId,
+        &chunk,
+        data.data(),
+        sampleCounts.data())
+      : exr_read_chunk(context, partId, &chunk, data.data());
+
+    return result == EXR_ERR_SUCCESS;
+}
+
+
+void OpenEXRImage::readChunkTables()
+{
+    const exr_const_context_t context = m_coreContext;
+
+    if (!context) {
+        return;
+    }
+
+    int nParts = 0;
+    exr_get_count(context, &nParts);
+
+    for (int part = 0; part < nParts; part++) {
+        std::vector<exr_chunk_info_t> chunks;
+        exr_chunk_info_t              chunk;
+        exr_storage_t                 storage;
+
+        bool valid = true;
+
+        exr_get_storage(context, part, &storage);
+
+        if (
+          storage == EXR_STORAGE_SCANLINE
+          || storage == EXR_STORAGE_DEEP_SCANLINE) {
+            exr_attr_box2i_t dataWindow;
+            int32_t          linesPerChunk = 1;
+
+            exr_get_data_window(context, part, &dataWindow);
+            exr_get_scanlines_per_chunk(context, part, &linesPerChunk);
+
+            for (int y = dataWindow.min.y; valid && y <= dataWindow.max.y;
+                 y += linesPerChunk) {
+                valid = exr_read_scanline_chunk_info(context, part, y, &chunk)
+                        == EXR_ERR_SUCCESS;
+
+                chunks.push_back(chunk);
+            }
+        } else {
+            uint32_t              tileW, tileH;
+            exr_tile_level_mode_t levelMode;
+            exr_tile_round_mode_t roundMode;
+            int32_t               nLevelsX = 1, nLevelsY = 1;
+
+            exr_get_tile_descriptor(
+              context,
+              part,
+              &tileW,
+              &tileH,
+              &levelMode,
+              &roundMode);
+            exr_get_tile_levels(context, part, &nLevelsX, &nLevelsY);
+
+            for (int ly = 0; valid && ly < nLevelsY; ly++) {
+                for (int lx = 0; valid && lx < nLevelsX; lx++) {
+                    // Mipmaps only have the levels of the diagonal
+                    if (levelMode == EXR_TILE_MIPMAP_LEVELS && lx != ly) {
+                        continue;
+                    }
+
+                    int32_t nTilesX = 0, nTilesY = 0;
+                    exr_get_tile_counts(
+                      context,
+                      part,
+                      lx,
+                      ly,
+                      &nTilesX,
+                      &nTilesY);
+
+                    for (int ty = 0; valid && ty < nTilesY; ty++) {
+                        for (int tx = 0; valid && tx < nTilesX; tx++) {
+                            valid = exr_read_tile_chunk_info(
+                                      context,
+                                      part,
+                                      tx,
+                                      ty,
+                                      lx,
+                                      ly,
+                                      &chunk)
+                                    == EXR_ERR_SUCCESS;
+
+                            chunks.push_back(chunk);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (!valid) {
+            chunks.clear();
+        }
+
+        m_chunkTables.push_back(chunks);
+    }
 }
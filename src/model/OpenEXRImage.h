@@ -35,19 +35,26 @@
 #include <QObject>
 #include <QAbstractItemModel>
 
+#include <OpenEXR/ImfIO.h>
 #include <OpenEXR/ImfMultiPartInputFile.h>
+#include <OpenEXR/openexr.h>
 
 #include <model/attribute/HeaderModel.h>
 #include <model/attribute/LayerModel.h>
+#include <model/framebuffer/ChannelCache.h>
+#include <model/framebuffer/ChannelPrefetcher.h>
 #include <model/framebuffer/FramebufferModel.h>
 
+#include <cstdint>
+#include <vector>
+
 class OpenEXRImage: public QObject
 {
     Q_OBJECT
 
   public:
     OpenEXRImage(const QString& filename, QObject* parent);
-    OpenEXRImage(std::istream& stream, QObject* parent);
+    OpenEXRImage(int fd, QObject* parent);
 
     ~OpenEXRImage();
 
@@ -60,12 +67,52 @@ class OpenEXRImage: public QObject
 
     bool isStream() const { return m_isStream; }
 
+    // Channels decoded by the framebuffer models of this image
+    ChannelCache& getChannelCache() { return m_channelCache; }
+
+    // Decodes the channels not displayed yet into the channel cache
+    ChannelPrefetcher& getPrefetcher() { return m_prefetcher; }
+
+    // Context reading the file with OpenEXRCore, null for streams or when
+    // OpenEXRCore cannot open the file
+    exr_const_context_t getCoreContext() const { return m_coreContext; }
+
+    // The part has the same layout and the same chunks in another version
+    // of the file, so its decoded pixels can be kept. The content of the
+    // chunks is only read when their offsets and sizes match, which needs
+    // the other version to still be readable: a file rewritten in place
+    // is always considered changed.
+    bool hasSamePart(const OpenEXRImage& other, int partId) const;
+
   private:
+    // Reads the location of the chunks of each part with the OpenEXRCore
+    // context
+    void readChunkTables();
+
+    // Reads the packed content of a chunk, and its sample count table for
+    // deep parts
+    static bool readChunk(
+      exr_const_context_t     context,
+      int                     partId,
+      const exr_chunk_info_t& chunk,
+      bool                    isDeep,
+      std::vector<uint8_t>&   data,
+      std::vector<uint8_t>&   sampleCounts);
+
     QString m_filename;
     bool    m_isStream;
 
+    // Stream the file is read from, null when OpenEXR opens the file itself
+    Imf::IStream*            m_stream;
     Imf::MultiPartInputFile* m_exrIn;
+    exr_context_t            m_coreContext;
 
     HeaderModel* m_headerModel;
     LayerModel*  m_layerModel;
+
+    ChannelCache      m_channelCache;
+    ChannelPrefetcher m_prefetcher;
+
+    // Chunks of each part, empty when unknown
+    std::vector<std::vector<exr_chunk_info_t>> m_chunkTables;
 };
@@ -0,0 +1,600 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "SequencePlayer.h"
+#include "FileIStream.h"
+
+#include <model/framebuffer/ChannelPlane.h>
+#include <model/framebuffer/DeepFlattener.h>
+#include <util/ColorTransform.h>
+#include <util/ThreadPool.h>
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QThread>
+
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfChromaticitiesAttribute.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfInputPart.h>
+#include <OpenEXR/ImfMultiPartInputFile.h>
+
+#include <Imath/ImathBox.h>
+#include <Imath/ImathMatrix.h>
+#include <Imath/ImathVec.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+std::atomic<size_t> SequencePlayer::s_memoryBudget(size_t(2) << 30);
+
+SequencePlayer::SequencePlayer(const FrameSequence& sequence, QObject* parent)
+  : QObject(parent)
+  , m_sequence(sequence)
+  , m_memoryUsed(0)
+  , m_decoder(new Decoder {{}, {}, {}, 0, false})
+  , m_exposureMul(1.f)
+  , m_halfTable(65536)
+  , m_currentFrame(sequence.getStartIndex())
+  , m_isFrameShown(false)
+  , m_isPlaying(false)
+  , m_fps(24.)
+  , m_readAhead(std::max(2, QThread::idealThreadCount()))
+  , m_playStart(0)
+  , m_playStartFrame(0)
+  , m_playedFrames(0)
+  , m_droppedFrames(0)
+{
+    ColorTransform::fill_sRGB_255_half_table(m_exposureMul, m_halfTable.data());
+
+    m_timer.setTimerType(Qt::PreciseTimer);
+    m_timer.setInterval(5);
+
+    connect(&m_timer, SIGNAL(timeout()), this, SLOT(onTick()));
+
+    m_clock.start();
+
+    setFrame(m_currentFrame);
+}
+
+
+SequencePlayer::~SequencePlayer()
+{
+    // The decodings do not use the player: the waiting ones are dropped and
+    // the running ones end on their own
+    std::lock_guard<std::mutex> lock(m_decoder->mutex);
+
+    m_decoder->canceled = true;
+    m_decoder->waiting.clear();
+}
+
+
+void SequencePlayer::play()
+{
+    if (m_isPlaying) {
+        return;
+    }
+
+    m_isPlaying      = true;
+    m_playStart      = m_clock.elapsed();
+    m_playStartFrame = m_currentFrame;
+    m_playedFrames   = 0;
+    m_droppedFrames  = 0;
+    m_shownTimes.clear();
+
+    m_timer.start();
+}
+
+
+void SequencePlayer::pause()
+{
+    m_isPlaying = false;
+
+    emit statisticsChanged(0., m_droppedFrames);
+}
+
+
+void SequencePlayer::setFrame(int index)
+{
+    if (index < 0 || index >= m_sequence.size()) {
+        return;
+    }
+
+    m_currentFrame = index;
+    m_isFrameShown = false;
+
+    // Continue playing from there
+    if (m_isPlaying) {
+        m_playStart      = m_clock.elapsed();
+        m_playStartFrame = index;
+        m_playedFrames   = 0;
+    }
+
+    collectDecoded();
+    readAhead(index);
+
+    if (m_frames.count(index)) {
+        showFrame(index);
+    }
+
+    m_timer.start();
+}
+
+
+void SequencePlayer::setFps(double fps)
+{
+    if (fps <= 0.) {
+        return;
+    }
+
+    m_fps = fps;
+
+    if (m_isPlaying) {
+        m_playStart      = m_clock.elapsed();
+        m_playStartFrame = m_currentFrame;
+        m_playedFrames   = 0;
+    }
+}
+
+
+void SequencePlayer::setExposure(double value)
+{
+    m_exposureMul = std::exp2(value);
+
+    // The decoded frames are kept, only their display changes
+    ColorTransform::fill_sRGB_255_half_table(m_exposureMul, m_halfTable.data());
+
+    if (m_isFrameShown && m_frames.count(m_currentFrame)) {
+        showFrame(m_currentFrame);
+    }
+}
+
+
+void SequencePlayer::setReadAhead(int nFrames)
+{
+    m_readAhead = std::max(1, nFrames);
+}
+
+
+void SequencePlayer::onTick()
+{
+    collectDecoded();
+
+    if (!m_isPlaying) {
+        if (!m_isFrameShown && m_frames.count(m_currentFrame)) {
+            showFrame(m_currentFrame);
+        }
+
+        // Only wait for the frames still being decoded
+        if (m_decodings.empty()) {
+            m_timer.stop();
+        }
+
+        return;
+    }
+
+    const int64_t position
+      = (int64_t)((m_clock.elapsed() - m_playStart) * m_fps / 1000.);
+
+    const int index = (int)((m_playStartFrame + position) % m_sequence.size());
+
+    // Frames are decoded ahead of the one which should be displayed now,
+    // the ones behind are late anyway
+    readAhead(index);
+
+    if (position <= m_playedFrames && m_isFrameShown) {
+        return;
+    }
+
+    if (!m_frames.count(index)) {
+        return;
+    }
+
+    // The frames skipped to catch up are dropped
+    if (m_isFrameShown && position > m_playedFrames + 1) {
+        m_droppedFrames += position - m_playedFrames - 1;
+    }
+
+    m_playedFrames = position;
+    m_currentFrame = index;
+
+    showFrame(index);
+
+    const qint64 now = m_clock.elapsed();
+
+    m_shownTimes.push_back(now);
+
+    while (m_shownTimes.front() <= now - 1000) {
+        m_shownTimes.pop_front();
+    }
+
+    // Achieved rate over the last second, or since the playback started
+    const qint64 duration = std::min((qint64)1000, now - m_playStart);
+
+    if (duration > 0) {
+        emit statisticsChanged(
+          m_shownTimes.size() * 1000. / duration,
+          m_droppedFrames);
+    }
+}
+
+
+void SequencePlayer::collectDecoded()
+{
+    std::map<int, std::shared_ptr<const Frame>> decoded;
+
+    {
+        std::lock_guard<std::mutex> lock(m_decoder->mutex);
+        decoded.swap(m_decoder->decoded);
+    }
+
+    for (const auto& frame : decoded) {
+        m_frames[frame.first] = frame.second;
+
+        if (frame.second) {
+            m_memoryUsed += frame.second->rgb.size() * sizeof(half);
+        }
+
+        m_decodings.erase(frame.first);
+    }
+
+    evict();
+}
+
+
+void SequencePlayer::readAhead(int index)
+{
+    const int nFrames = std::min(m_readAhead, m_sequence.size());
+
+    for (int i = 0; i < nFrames; i++) {
+        const int frame = (index + i) % m_sequence.size();
+
+        if (m_frames.count(frame) || m_decodings.count(frame)) {
+            continue;
+        }
+
+        // Keeps the number of frames decoded at once bounded when the
+        // playback is ahead of the decoding
+        if ((int)m_decodings.size() >= nFrames) {
+            break;
+        }
+
+        m_decodings.insert(frame);
+
+        std::lock_guard<std::mutex> lock(m_decoder->mutex);
+        m_decoder->waiting.emplace_back(frame, m_sequence.getFilename(frame));
+    }
+
+    // A worker is left to the images being opened
+    const int maxTasks = std::min(
+      (int)m_decodings.size(),
+      std::max(1, ThreadPool::globalPool().getNumThreads() - 1));
+
+    int nNewTasks = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_decoder->mutex);
+
+        nNewTasks = std::max(0, maxTasks - m_decoder->nTasks);
+        m_decoder->nTasks += nNewTasks;
+    }
+
+    const std::shared_ptr<Decoder> decoder = m_decoder;
+
+    for (int i = 0; i < nNewTasks; i++) {
+        ThreadPool::globalPool().addTask([decoder]() { decode(decoder); });
+    }
+}
+
+
+void SequencePlayer::decode(const std::shared_ptr<Decoder>& decoder)
+{
+    std::pair<int, QString> frame;
+
+    {
+        std::lock_guard<std::mutex> lock(decoder->mutex);
+
+        if (decoder->canceled || decoder->waiting.empty()) {
+            decoder->nTasks--;
+            return;
+        }
+
+        frame = decoder->waiting.front();
+        decoder->waiting.pop_front();
+    }
+
+    std::shared_ptr<const Frame> decoded;
+
+    try {
+        decoded = decodeFrame(frame.second);
+    } catch (std::exception& e) {
+        std::cerr << "Loading error: " << frame.second.toStdString() << ": "
+                  << e.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(decoder->mutex);
+        decoder->decoded[frame.first] = decoded;
+    }
+
+    // A frame per task, so the workers can pick the tasks of the images
+    // being opened in between
+    ThreadPool::globalPool().addTask([decoder]() { decode(decoder); });
+}
+
+
+void SequencePlayer::evict()
+{
+    if (m_memoryUsed <= s_memoryBudget) {
+        return;
+    }
+
+    // The frames needed last come first
+    std::vector<int> frames;
+
+    for (const auto& frame : m_frames) {
+        frames.push_back(frame.first);
+    }
+
+    std::sort(frames.begin(), frames.end(), [this](int a, int b) {
+        return getDistance(a) > getDistance(b);
+    });
+
+    for (int frame : frames) {
+        // The displayed frame is always kept
+        if (m_memoryUsed <= s_memoryBudget || frame == m_currentFrame) {
+            break;
+        }
+
+        if (m_frames[frame]) {
+            m_memoryUsed -= m_frames[frame]->rgb.size() * sizeof(half);
+        }
+
+        m_frames.erase(frame);
+    }
+}
+
+
+void SequencePlayer::showFrame(int index)
+{
+    m_isFrameShown = true;
+
+    const std::shared_ptr<const Frame>& frame = m_frames[index];
+
+    emit frameChanged(index, frame ? toImage(*frame) : QImage());
+}
+
+
+QImage SequencePlayer::toImage(const Frame& frame) const
+{
+    QImage image(frame.width, frame.height, QImage::Format_RGB32);
+
+    // Detach once here rather than concurrently in each worker
+    unsigned char* const       bits         = image.bits();
+    const size_t               bytesPerLine = image.bytesPerLine();
+    const unsigned char* const table        = m_halfTable.data();
+
+    ThreadPool::globalPool().parallelFor(
+      0,
+      frame.height,
+      [&](int64_t y0, int64_t y1) {
+          for (int y = y0; y < y1; y++) {
+              QRgb* line = reinterpret_cast<QRgb*>(bits + y * bytesPerLine);
+              const half* rgb = &frame.rgb[3 * (size_t)y * frame.width];
+
+              for (int x = 0; x < frame.width; x++) {
+                  line[x] = qRgb(
+                    table[rgb[3 * x].bits()],
+                    table[rgb[3 * x + 1].bits()],
+                    table[rgb[3 * x + 2].bits()]);
+              }
+          }
+      },
+      16);
+
+    return image;
+}
+
+
+int SequencePlayer::getDistance(int index) const
+{
+    return (index - m_currentFrame + m_sequence.size()) % m_sequence.size();
+}
+
+
+std::shared_ptr<const SequencePlayer::Frame>
+SequencePlayer::decodeFrame(const QString& filename)
+{
+    // Frames are not watched and are only opened while they are decoded so
+    // they are mapped, unless they were modified recently and may still be
+    // written by a renderer
+    const bool isSettled
+      = QFileInfo(filename).lastModified().secsTo(QDateTime::currentDateTime())
+        > 5;
+
+    std::unique_ptr<FileIStream>             stream;
+    std::unique_ptr<Imf::MultiPartInputFile> file;
+
+    try {
+        stream.reset(new FileIStream(filename, isSettled));
+    } catch (std::exception&) {
+    }
+
+    if (stream) {
+        file.reset(new Imf::MultiPartInputFile(*stream));
+    } else {
+        file.reset(new Imf::MultiPartInputFile(filename.toStdString().c_str()));
+    }
+
+    const Imf::Header&      header   = file->header(0);
+    const Imf::ChannelList& channels = header.channels();
+
+    std::array<std::string, 3> names;
+
+    if (
+      channels.findChannel("R") && channels.findChannel("G")
+      && channels.findChannel("B")) {
+        names = {{"R", "G", "B"}};
+    } else if (channels.findChannel("Y")) {
+        names = {{"Y", "Y", "Y"}};
+    } else if (channels.begin() != channels.end()) {
+        const std::string name = channels.begin().name();
+        names                  = {{name, name, name}};
+    } else {
+        throw std::runtime_error("The frame has no channel");
+    }
+
+    const Imath::Box2i dataW  = header.dataWindow();
+    const Imath::Box2i dispW  = header.displayWindow();
+    const int          width  = dataW.max.x - dataW.min.x + 1;
+    const int          height = dataW.max.y - dataW.min.y + 1;
+
+    // Luminance and single channels share the same plane
+    std::array<std::shared_ptr<ChannelPlane>, 3> planes;
+    std::array<Imath::V2i, 3>                    samplings;
+
+    Imf::FrameBuffer               framebuffer;
+    std::unique_ptr<DeepFlattener> flattener;
+
+    if (DeepFlattener::isDeep(header)) {
+        flattener.reset(new DeepFlattener(*file, 0));
+    }
+
+    for (int c = 0; c < 3; c++) {
+        const Imf::Channel& channel = *channels.findChannel(names[c]);
+
+        samplings[c] = Imath::V2i(channel.xSampling, channel.ySampling);
+
+        if (c > 0 && names[c] == names[0]) {
+            planes[c] = planes[0];
+            continue;
+        }
+
+        planes[c] = std::make_shared<ChannelPlane>(
+          channel.type,
+          (width - 1) / channel.xSampling + 1,
+          (height - 1) / channel.ySampling + 1);
+
+        if (flattener) {
+            flattener->addChannel(names[c], planes[c].get());
+        } else {
+            framebuffer.insert(
+              names[c],
+              planes[c]->slice(
+                dataW.min,
+                channel.xSampling,
+                channel.ySampling));
+        }
+    }
+
+    if (flattener) {
+        flattener->readLines(dataW.min.y, dataW.max.y);
+    } else {
+        Imf::InputPart part(*file, 0);
+        part.setFrameBuffer(framebuffer);
+        part.readPixels(dataW.min.y, dataW.max.y);
+    }
+
+    // Same conversion to sRGB primaries as the RGB layers
+    Imath::M44f conversion;
+
+    if (names[0] == "R") {
+        const Imf::ChromaticitiesAttribute* c
+          = header.findTypedAttribute<Imf::ChromaticitiesAttribute>(
+            "chromaticities");
+
+        if (c != nullptr) {
+            conversion = Imf::RGBtoXYZ(c->value(), 1.f)
+                         * Imf::XYZtoRGB(Imf::Chromaticities(), 1.f);
+        }
+    }
+
+    const bool convertColors = conversion != Imath::M44f();
+
+    // The frame is framed by its display window, black outside the data
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+
+    frame->width  = dispW.max.x - dispW.min.x + 1;
+    frame->height = dispW.max.y - dispW.min.y + 1;
+    frame->rgb.resize(3 * (size_t)frame->width * frame->height, half(0.f));
+
+    const int xStart = std::max(dataW.min.x, dispW.min.x);
+    const int xEnd   = std::min(dataW.max.x, dispW.max.x);
+    const int yStart = std::max(dataW.min.y, dispW.min.y);
+    const int yEnd   = std::min(dataW.max.y, dispW.max.y);
+
+    if (xStart > xEnd || yStart > yEnd) {
+        return frame;
+    }
+
+    ThreadPool::globalPool().parallelFor(
+      yStart,
+      yEnd + 1,
+      [&](int64_t y0, int64_t y1) {
+          for (int y = y0; y < y1; y++) {
+              half* line = frame->rgb.data()
+                           + 3 * (size_t)(y - dispW.min.y) * frame->width;
+
+              for (int x = xStart; x <= xEnd; x++) {
+                  float rgb[3];
+
+                  for (int c = 0; c < 3; c++) {
+                      rgb[c] = planes[c]->value(
+                        (x - dataW.min.x) / samplings[c].x,
+                        (y - dataW.min.y) / samplings[c].y);
+                  }
+
+                  Imath::V3f color(rgb[0], rgb[1], rgb[2]);
+
+                  if (convertColors) {
+                      color *= conversion;
+                  }
+
+                  half* pixel = line + 3 * (x - dispW.min.x);
+
+                  pixel[0] = color.x;
+                  pixel[1] = color.y;
+                  pixel[2] = color.z;
+              }
+          }
+      },
+      16);
+
+    return frame;
+}
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "FrameSequence.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <Imath/half.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+// Plays the frames of a sequence at a given rate.
+//
+// The frames following the one being displayed are decoded in parallel
+// ahead of time and the decoded frames are kept within a memory budget, so
+// a sequence fitting in it is only decoded once. They are kept linear, the
+// exposure being applied when a frame is displayed. A frame not decoded in
+// time is dropped to keep up with the frame rate.
+class SequencePlayer: public QObject
+{
+    Q_OBJECT
+
+  public:
+    SequencePlayer(const FrameSequence& sequence, QObject* parent = nullptr);
+    virtual ~SequencePlayer();
+
+    const FrameSequence& getSequence() const { return m_sequence; }
+
+    int    getCurrentFrame() const { return m_currentFrame; }
+    bool   isPlaying() const { return m_isPlaying; }
+    double getFps() const { return m_fps; }
+
+    // Number of frames decoded ahead of the displayed one
+    int getReadAhead() const { return m_readAhead; }
+
+    // Memory in bytes the decoded frames of a sequence can use
+    static size_t getMemoryBudget() { return s_memoryBudget; }
+    static void   setMemoryBudget(size_t bytes) { s_memoryBudget = bytes; }
+
+  public slots:
+    void play();
+    void pause();
+    void setFrame(int index);
+    void setFps(double fps);
+    void setExposure(double value);
+    void setReadAhead(int nFrames);
+
+  signals:
+    // The image is null when the frame could not be read
+    void frameChanged(int index, const QImage& image);
+
+    // Frame rate achieved over the last second and number of frames
+    // dropped since the playback started
+    void statisticsChanged(double fps, int droppedFrames);
+
+  private slots:
+    void onTick();
+
+  private:
+    // Linear RGB pixels of a frame in the sRGB primaries, framed by its
+    // display window
+    struct Frame
+    {
+        int               width;
+        int               height;
+        std::vector<half> rgb;
+    };
+
+    // Frames decoded on the global thread pool, shared with the decoding
+    // tasks which may outlive the player
+    struct Decoder
+    {
+        std::mutex                                  mutex;
+        std::deque<std::pair<int, QString>>         waiting;
+        std::map<int, std::shared_ptr<const Frame>> decoded;
+        int                                         nTasks;
+        bool                                        canceled;
+    };
+
+    // Reads the first part of a file as displayed by the RGB layers,
+    // falling back to its luminance or its first channel
+    static std::shared_ptr<const Frame> decodeFrame(const QString& filename);
+
+    // Decoding task: decodes the first waiting frame and queues itself again
+    // while frames are waiting
+    static void decode(const std::shared_ptr<Decoder>& decoder);
+
+    // Applies the exposure and encodes the frame in sRGB
+    QImage toImage(const Frame& frame) const;
+
+    // Moves the decoded frames to the cache
+    void collectDecoded();
+
+    // Starts decoding the frames from the given one which are neither
+    // decoded nor being decoded
+    void readAhead(int index);
+
+    // Releases the frames needed last until the cache fits in the budget
+    void evict();
+
+    void showFrame(int index);
+
+    // Position of a frame in the playing order from the displayed one
+    int getDistance(int index) const;
+
+    static std::atomic<size_t> s_memoryBudget;
+
+    FrameSequence m_sequence;
+
+    // Null for the frames which could not be read
+    std::map<int, std::shared_ptr<const Frame>> m_frames;
+    size_t                                      m_memoryUsed;
+
+    // Frames waiting for or being decoded
+    std::shared_ptr<Decoder> m_decoder;
+    std::set<int>            m_decodings;
+
+    // Display value of each half bit pattern with the current exposure
+    float                      m_exposureMul;
+    std::vector<unsigned char> m_halfTable;
+
+    int    m_currentFrame;
+    bool   m_isFrameShown;
+    bool   m_isPlaying;
+    double m_fps;
+    int    m_readAhead;
+
+    QTimer        m_timer;
+    QElapsedTimer m_clock;
+
+    // Frame the playback started from and number of frames played since
+    qint64  m_playStart;
+    int     m_playStartFrame;
+    int64_t m_playedFrames;
+
+    int                m_droppedFrames;
+    std::deque<qint64> m_shownTimes;
+};
@@ -1,23 +1,313 @@
 #include "StdIStream.h"
 
-StdIStream::StdIStream(std::istream& stream)
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#    define NOMINMAX
+#    include <Windows.h>
+#    include <io.h>
+#else
+#    include <cerrno>
+#    include <poll.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+StdIStream::Spool::Spool()
+  : data(nullptr)
+  , capacity(0)
+  , committed(0)
+  , size(0)
+  , finished(false)
+  , stopped(false)
+{
+    // Reserve address space only: memory is used as the stream is read.
+    // Try smaller regions when the address space is limited.
+    const uint64_t minCapacity = uint64_t(64) << 20;
+
+    for (uint64_t reserve = sizeof(void*) >= 8 ? uint64_t(1) << 40
+                                                : uint64_t(1) << 30;
+         reserve >= minCapacity && data == nullptr;
+         reserve /= 2) {
+#ifdef _WIN32
+        data = (char*)
+          VirtualAlloc(nullptr, (SIZE_T)reserve, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        void* ptr = mmap(
+          nullptr,
+          (size_t)reserve,
+          PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+          -1,
+          0);
+
+        data = ptr == MAP_FAILED ? nullptr : (char*)ptr;
+#endif
+        if (data != nullptr) {
+            capacity = reserve;
+        }
+    }
+}
+
+
+StdIStream::Spool::~Spool()
+{
+    if (data != nullptr) {
+#ifdef _WIN32
+        VirtualFree(data, 0, MEM_RELEASE);
+#else
+        munmap(data, (size_t)capacity);
+#endif
+    }
+}
+
+
+bool StdIStream::Spool::commit(uint64_t newSize)
+{
+    if (newSize > capacity) {
+        return false;
+    }
+
+#ifdef _WIN32
+    if (newSize > committed) {
+        // Grow by steps of 16 MB to limit the number of calls
+        const uint64_t step = uint64_t(16) << 20;
+        const uint64_t target
+          = std::min(capacity, (newSize + step - 1) / step * step);
+
+        if (
+          VirtualAlloc(
+            data + committed,
+            (SIZE_T)(target - committed),
+            MEM_COMMIT,
+            PAGE_READWRITE)
+          == nullptr) {
+            return false;
+        }
+
+        committed = target;
+    }
+#else
+    // Pages of anonymous mappings are allocated on first access
+    committed = std::max(committed, newSize);
+#endif
+
+    return true;
+}
+
+
+StdIStream::StdIStream(int fd)
   : IStream("Stream")
-  , m_stream(stream)
-{}
+  , m_fd(fd)
+  , m_spool(new Spool)
+  , m_position(0)
+{
+    if (m_spool->data == nullptr) {
+        throw std::runtime_error("Cannot allocate memory to read the stream");
+    }
+
+#ifndef _WIN32
+    if (pipe(m_wakeFds) != 0) {
+        throw std::runtime_error("Cannot create the stream reader");
+    }
+#endif
+
+    m_thread = std::thread(&StdIStream::spool, this);
+}
+
+
+StdIStream::~StdIStream()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_spool->mutex);
+        m_spool->stopped = true;
+
+#ifdef _WIN32
+        // The spooling thread may be blocked in ReadFile: cancel it until
+        // the thread notices the stop
+        while (!m_spool->finished) {
+            CancelSynchronousIo((HANDLE)m_thread.native_handle());
+            m_spool->dataAvailable.wait_for(
+              lock,
+              std::chrono::milliseconds(10));
+        }
+#endif
+    }
+
+#ifndef _WIN32
+    // Wake up the spooling thread if it waits for the source
+    const char c = 0;
+    while (write(m_wakeFds[1], &c, 1) < 0 && errno == EINTR) {
+    }
+#endif
+
+    m_thread.join();
+
+#ifndef _WIN32
+    close(m_wakeFds[0]);
+    close(m_wakeFds[1]);
+#endif
+}
+
+
+int64_t StdIStream::readSource(char* data, uint64_t n)
+{
+#ifdef _WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle(m_fd);
+
+    if (handle == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+
+    DWORD count = 0;
+
+    if (!ReadFile(handle, data, (DWORD)n, &count, nullptr)) {
+        const DWORD error = GetLastError();
+
+        // The writer closed the pipe or the read was canceled on destruction
+        if (error == ERROR_BROKEN_PIPE || error == ERROR_OPERATION_ABORTED) {
+            return 0;
+        }
+
+        return -1;
+    }
+
+    return count;
+#else
+    while (true) {
+        pollfd fds[2] = {{m_fd, POLLIN, 0}, {m_wakeFds[0], POLLIN, 0}};
+
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        if (fds[1].revents != 0) {
+            return 0;
+        }
+
+        const ssize_t count = ::read(m_fd, data, (size_t)n);
+
+        if (count < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+
+            return -1;
+        }
+
+        return count;
+    }
+#endif
+}
+
+
+void StdIStream::spool()
+{
+    const uint64_t chunkSize = uint64_t(1) << 16;
+
+    std::string error;
+
+    while (true) {
+        uint64_t size;
+
+        {
+            std::lock_guard<std::mutex> lock(m_spool->mutex);
+
+            if (m_spool->stopped) {
+                break;
+            }
+
+            size = m_spool->size;
+        }
+
+        if (!m_spool->commit(size + chunkSize)) {
+            error = "The stream is too large to be read";
+            break;
+        }
+
+        // Only this thread writes past the spooled size: no lock needed
+        const int64_t n = readSource(m_spool->data + size, chunkSize);
+
+        if (n < 0) {
+            error = "Cannot read the stream";
+            break;
+        } else if (n == 0) {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_spool->mutex);
+            m_spool->size += n;
+        }
+
+        m_spool->dataAvailable.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_spool->mutex);
+        m_spool->finished = true;
+        m_spool->error    = error;
+    }
+
+    m_spool->dataAvailable.notify_all();
+}
+
+
+char* StdIStream::readMemoryMapped(int n)
+{
+    if (n < 0) {
+        throw std::runtime_error("Invalid read size");
+    }
+
+    std::unique_lock<std::mutex> lock(m_spool->mutex);
+
+    // Wait for the source to provide the requested bytes
+    m_spool->dataAvailable.wait(lock, [this, n]() {
+        return m_spool->size >= m_position + n || m_spool->finished;
+    });
+
+    if (m_spool->size < m_position + n) {
+        throw std::runtime_error(
+          m_spool->error.empty() ? "Unexpected end of stream" : m_spool->error);
+    }
+
+    char* data = m_spool->data + m_position;
+    m_position += n;
+
+    return data;
+}
+
 
 bool StdIStream::read(char c[], int n)
 {
-    m_stream.read(c, n);
+    std::memcpy(c, readMemoryMapped(n), n);
 
-    return m_stream.good();
+    // Tell whether the end of the stream is reached: this waits for the
+    // next byte or for the source to be drained
+    std::unique_lock<std::mutex> lock(m_spool->mutex);
+
+    m_spool->dataAvailable.wait(lock, [this]() {
+        return m_spool->size > m_position || m_spool->finished;
+    });
+
+    return m_spool->size > m_position;
 }
 
+
 uint64_t StdIStream::tellg()
 {
-    return m_stream.tellg();
+    return m_position;
 }
 
+
 void StdIStream::seekg(uint64_t pos)
 {
-    m_stream.seekg(pos);
+    m_position = pos;
 }
@@ -30,22 +30,77 @@
  * OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+
 #pragma once
 
 #include <OpenEXR/ImfIO.h>
 
-#include <istream>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 
+// Input stream reading a file descriptor (e.g., stdin) which may not be
+// seekable.
+//
+// The source is spooled in the background into a reserved memory region
+// that never moves, so the spooled data is exposed as memory mapped and
+// OpenEXR can start parsing the header before the source is drained.
+// Reads wait for the requested bytes to arrive and seeks only move within
+// the spooled data: the source is read once, sequentially.
+//
+// The descriptor is not closed. Destroying the stream interrupts a pending
+// read of the source and waits for the spooling thread to exit.
 class StdIStream: public Imf::IStream
 {
   public:
-    StdIStream(std::istream& stream);
+    StdIStream(int fd);
+    virtual ~StdIStream();
+
+    virtual bool     isMemoryMapped() const { return true; }
+    virtual char*    readMemoryMapped(int n);
     virtual bool     read(char c[/*n*/], int n);
     virtual uint64_t tellg();
     virtual void     seekg(uint64_t pos);
 
-    virtual bool isMemoryMapped() const { return false; }
-
   private:
-    std::istream& m_stream;
+    // Memory shared with the spooling thread
+    struct Spool
+    {
+        Spool();
+        ~Spool();
+
+        // Makes the first `size` bytes of the reserved region writable
+        bool commit(uint64_t size);
+
+        char*    data;
+        uint64_t capacity;
+        uint64_t committed;
+
+        std::mutex              mutex;
+        std::condition_variable dataAvailable;
+
+        uint64_t    size;
+        bool        finished;
+        bool        stopped;
+        std::string error;
+    };
+
+    void spool();
+
+    // Reads at most `n` bytes from the source, returns -1 on error and 0 at
+    // the end of the source or when the spooling is stopped
+    int64_t readSource(char* data, uint64_t n);
+
+    int                    m_fd;
+    std::unique_ptr<Spool> m_spool;
+    uint64_t               m_position;
+
+#ifndef _WIN32
+    // Pipe waking up the spooling thread when the stream is destroyed
+    int m_wakeFds[2];
+#endif
+
+    std::thread m_thread;
 };
@@ -131,6 +131,18 @@ LayerItem* LayerItem::addLeaf(
     return pLeafPtr;
 }
 
+
+LayerItem*
+LayerItem::addSampleCountLeaf(Imf::MultiPartInputFile& file, int part)
+{
+    LayerItem* pLeaf
+      = new LayerItem(file, this, "sampleCount", "", nullptr, part);
+
+    pLeaf->m_type = SAMPLE_COUNT;
+
+    return pLeaf;
+}
+
 void LayerItem::createThumbnails()
 {
     createThumbnails(this);
@@ -55,6 +55,8 @@ class LayerItem
         RY,
         BY,
         GENERAL,
+        // Number of samples of the pixels of a deep part
+        SAMPLE_COUNT,
         // Group Types,
         RGB,
         RGBA,
@@ -82,6 +84,8 @@ class LayerItem
       const Imf::Channel*      pChannel,
       int                      part = -1);
 
+    // Adds a leaf showing the number of samples of the pixels of a deep part
+    LayerItem* addSampleCountLeaf(Imf::MultiPartInputFile& file, int part = -1);
 
     void createThumbnails();
 
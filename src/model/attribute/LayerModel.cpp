@@ -32,6 +32,8 @@
 
 #include "LayerModel.h"
 
+#include <model/framebuffer/DeepFlattener.h>
+
 #include <OpenEXR/ImfHeader.h>
 #include <OpenEXR/ImfChannelList.h>
 
@@ -67,6 +69,10 @@ LayerModel::LayerModel(Imf::MultiPartInputFile& file, QObject* parent)
                  it++) {
                 leaf->addLeaf(m_fileHandle, it.name(), &it.channel(), part);
             }
+
+            if (DeepFlattener::isDeep(exrHeader)) {
+                leaf->addSampleCountLeaf(m_fileHandle, part);
+            }
         }
     } else {
         const Imf::Header& exrHeader = file.header(0);
@@ -79,6 +85,10 @@ LayerModel::LayerModel(Imf::MultiPartInputFile& file, QObject* parent)
              it++) {
             m_rootItem->addLeaf(m_fileHandle, it.name(), &it.channel());
         }
+
+        if (DeepFlattener::isDeep(exrHeader)) {
+            m_rootItem->addSampleCountLeaf(m_fileHandle);
+        }
     }
 
     m_rootItem->groupLayers();
@@ -115,6 +125,7 @@ QVariant LayerModel::data(const QModelIndex& index, int role) const
                         case LayerItem::RY:
                         case LayerItem::BY:
                         case LayerItem::GENERAL:
+                        case LayerItem::SAMPLE_COUNT:
                             return QIcon(":/svg/038-image.svg");
 
                         case LayerItem::RGB:
@@ -162,6 +173,7 @@ QVariant LayerModel::data(const QModelIndex& index, int role) const
                         case LayerItem::GROUP:   return tr("Group");
                         case LayerItem::PART:    return tr("Part") + " " + QString::number(item->getPart());
                         case LayerItem::GENERAL: return tr("Framebuffer");
+                        case LayerItem::SAMPLE_COUNT: return tr("Sample count");
                         default: return QVariant();
                     }
                 case PIXELTYPE:
@@ -182,7 +194,8 @@ QVariant LayerModel::data(const QModelIndex& index, int role) const
                 tooltip += "<b>Part ID:</b> " + QString::number(item->getPart());
 
                 // When it is a layer group, we do not want to display an empty layer name
-                if (item->getType() != LayerItem::GROUP && item->getType() != LayerItem::PART) {
+                if (item->getType() != LayerItem::GROUP && item->getType() != LayerItem::PART
+                    && item->getType() != LayerItem::SAMPLE_COUNT) {
                     tooltip += "<br/>";
                     tooltip += "<b>Layer name:</b> " + QString::fromStdString(item->getOriginalFullName());
                 }
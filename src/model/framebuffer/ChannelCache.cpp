@@ -0,0 +1,82 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ChannelCache.h"
+
+std::shared_ptr<ChannelPlane>
+ChannelCache::find(int partId, const std::string& channel) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto it = m_planes.find(Key(partId, channel));
+
+    if (it == m_planes.end()) {
+        return nullptr;
+    }
+
+    return it->second.lock();
+}
+
+
+void ChannelCache::insert(
+  int                                  partId,
+  const std::string&                   channel,
+  const std::shared_ptr<ChannelPlane>& plane)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Forget the planes released since the last insertion
+    for (auto it = m_planes.begin(); it != m_planes.end();) {
+        if (it->second.expired()) {
+            it = m_planes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    m_planes[Key(partId, channel)] = plane;
+}
+
+
+void ChannelCache::import(const ChannelCache& other, int partId)
+{
+    std::lock(m_mutex, other.m_mutex);
+    std::lock_guard<std::mutex> lock(m_mutex, std::adopt_lock);
+    std::lock_guard<std::mutex> otherLock(other.m_mutex, std::adopt_lock);
+
+    for (const auto& entry : other.m_planes) {
+        if (entry.first.first == partId && !entry.second.expired()) {
+            m_planes[entry.first] = entry.second;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "ChannelPlane.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+// Decoded channels of an image, shared between the framebuffer models
+// displaying them so a channel is decoded and stored only once.
+//
+// Only planes covering the whole data window at full resolution are
+// shared. The cache does not own them: a plane is released as soon as no
+// model or prefetcher uses it anymore.
+class ChannelCache
+{
+  public:
+    // Returns the plane of the channel or null if it is not decoded yet
+    std::shared_ptr<ChannelPlane>
+    find(int partId, const std::string& channel) const;
+
+    // Makes a fully decoded plane available to other models
+    void insert(
+      int                                  partId,
+      const std::string&                   channel,
+      const std::shared_ptr<ChannelPlane>& plane);
+
+    // Shares the planes of a part still in use in another cache, e.g. when
+    // the part did not change in a new version of the file
+    void import(const ChannelCache& other, int partId);
+
+  private:
+    typedef std::pair<int, std::string> Key;
+
+    mutable std::mutex                         m_mutex;
+    std::map<Key, std::weak_ptr<ChannelPlane>> m_planes;
+};
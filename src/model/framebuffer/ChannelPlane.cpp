@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ChannelPlane.h"
+
+#include <QDir>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+
+const size_t ChannelPlane::s_outOfCoreSize = size_t(512) << 20;
+
+std::mutex ChannelPlane::s_spillMutex;
+QString    ChannelPlane::s_spillDirectory;
+
+
+QString ChannelPlane::getSpillDirectory()
+{
+    std::lock_guard<std::mutex> lock(s_spillMutex);
+
+    if (!s_spillDirectory.isEmpty()) {
+        return s_spillDirectory;
+    }
+
+    // The temporary folder is often a tmpfs, the cache is kept on disk
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+           + "/planes";
+}
+
+
+void ChannelPlane::setSpillDirectory(const QString& path)
+{
+    std::lock_guard<std::mutex> lock(s_spillMutex);
+
+    s_spillDirectory = path;
+}
+
+ChannelPlane::ChannelPlane(Imf::PixelType fileType, int width, int height)
+  : m_type(fileType == Imf::HALF ? Imf::HALF : Imf::FLOAT)
+  , m_width(width)
+  , m_height(height)
+  , m_data(nullptr)
+{
+    const size_t size = (size_t)width * (size_t)height * pixelSize();
+
+    if (size > s_outOfCoreSize) {
+        const QString directory = getSpillDirectory();
+        QDir().mkpath(directory);
+
+        m_file.reset(new QTemporaryFile(directory + "/plane-XXXXXX"));
+
+        if (m_file->open() && m_file->resize(size)) {
+            m_data = reinterpret_cast<char*>(m_file->map(0, size));
+        }
+
+        // Fall back to memory if the file cannot be mapped
+        if (m_data == nullptr) {
+            m_file.reset();
+        }
+    }
+
+    if (m_data == nullptr) {
+        m_heap.resize(size);
+        m_data = m_heap.data();
+    }
+}
+
+
+ChannelPlane::~ChannelPlane()
+{
+    if (m_file) {
+        m_file->unmap(reinterpret_cast<uchar*>(m_data));
+    }
+}
+
+
+Imf::Slice
+ChannelPlane::slice(const Imath::V2i& origin, int xSampling, int ySampling)
+{
+    return Imf::Slice::Make(
+      m_type,
+      m_data,
+      origin,
+      m_width,
+      m_height,
+      pixelSize(),
+      pixelSize() * m_width,
+      xSampling,
+      ySampling);
+}
+
+
+void ChannelPlane::getLine(
+  int y, float* line, int count, int step, int x) const
+{
+    const size_t offset = (size_t)y * m_width + x;
+
+    if (m_type == Imf::HALF) {
+        const half* src = reinterpret_cast<const half*>(m_data) + offset;
+
+        for (int i = 0; i < count; i++) {
+            line[i] = src[(size_t)i * step];
+        }
+    } else {
+        const float* src = reinterpret_cast<const float*>(m_data) + offset;
+
+        if (step == 1) {
+            std::copy(src, src + count, line);
+        } else {
+            for (int i = 0; i < count; i++) {
+                line[i] = src[(size_t)i * step];
+            }
+        }
+    }
+}
+
+
+void ChannelPlane::getLine(
+  int y, half* line, int count, int step, int x) const
+{
+    const half* src
+      = reinterpret_cast<const half*>(m_data) + (size_t)y * m_width + x;
+
+    if (step == 1) {
+        std::copy(src, src + count, line);
+    } else {
+        for (int i = 0; i < count; i++) {
+            line[i] = src[(size_t)i * step];
+        }
+    }
+}
+
+
+void ChannelPlane::copy(
+  const ChannelPlane& other,
+  int                 srcX,
+  int                 srcY,
+  int                 dstX,
+  int                 dstY,
+  int                 w,
+  int                 h)
+{
+    const size_t size = pixelSize();
+
+    for (int y = 0; y < h; y++) {
+        const size_t src = (size_t)(srcY + y) * other.m_width + srcX;
+        const size_t dst = (size_t)(dstY + y) * m_width + dstX;
+
+        std::memcpy(m_data + dst * size, other.m_data + src * size, w * size);
+    }
+}
@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfPixelType.h>
+
+#include <Imath/ImathVec.h>
+#include <Imath/half.h>
+
+#include <QString>
+#include <QTemporaryFile>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Single channel of a framebuffer stored with the precision of the file:
+// HALF channels are kept as half, other types are stored as float.
+//
+// Large planes are backed by a memory mapped temporary file instead of
+// the heap so only the pages actually accessed stay resident.
+class ChannelPlane
+{
+  public:
+    ChannelPlane(Imf::PixelType fileType, int width, int height);
+    ~ChannelPlane();
+
+    ChannelPlane(const ChannelPlane&) = delete;
+    ChannelPlane& operator=(const ChannelPlane&) = delete;
+
+    Imf::PixelType type() const { return m_type; }
+    int            width() const { return m_width; }
+    int            height() const { return m_height; }
+
+    bool isOutOfCore() const { return m_file != nullptr; }
+
+    // Folder of the files backing the large planes. It should be on a disk:
+    // a tmpfs folder keeps the planes in memory. An empty path selects a
+    // folder of the cache location of the application.
+    static QString getSpillDirectory();
+    static void    setSpillDirectory(const QString& path);
+
+    size_t sizeInBytes() const
+    {
+        return pixelSize() * m_width * m_height;
+    }
+
+    // Slice reading the channel into the plane, `origin` being the position
+    // of the first pixel of the plane in the file (before subsampling)
+    Imf::Slice
+    slice(const Imath::V2i& origin, int xSampling = 1, int ySampling = 1);
+
+    float value(size_t index) const
+    {
+        return m_type == Imf::HALF
+                 ? (float)reinterpret_cast<const half*>(m_data)[index]
+                 : reinterpret_cast<const float*>(m_data)[index];
+    }
+
+    float value(int x, int y) const
+    {
+        return value((size_t)y * m_width + x);
+    }
+
+    void setValue(size_t index, float value)
+    {
+        if (m_type == Imf::HALF) {
+            reinterpret_cast<half*>(m_data)[index] = value;
+        } else {
+            reinterpret_cast<float*>(m_data)[index] = value;
+        }
+    }
+
+    // Converts `count` pixels of the line y to float, taking one pixel every
+    // `step` pixels from the pixel x
+    void
+    getLine(int y, float* line, int count, int step = 1, int x = 0) const;
+
+    // Same for HALF planes, keeping the pixels as half
+    void getLine(int y, half* line, int count, int step = 1, int x = 0) const;
+
+    half*  halfData() { return reinterpret_cast<half*>(m_data); }
+    float* floatData() { return reinterpret_cast<float*>(m_data); }
+
+    // Copies a w x h block of pixels from another plane of the same type
+    void copy(
+      const ChannelPlane& other,
+      int                 srcX,
+      int                 srcY,
+      int                 dstX,
+      int                 dstY,
+      int                 w,
+      int                 h);
+
+  private:
+    size_t pixelSize() const
+    {
+        return m_type == Imf::HALF ? sizeof(half) : sizeof(float);
+    }
+
+    // Planes above this size in bytes are stored out of core
+    static const size_t s_outOfCoreSize;
+
+    static std::mutex s_spillMutex;
+    static QString    s_spillDirectory;
+
+    Imf::PixelType m_type;
+    int            m_width;
+    int            m_height;
+
+    char*                           m_data;
+    std::vector<char>               m_heap;
+    std::unique_ptr<QTemporaryFile> m_file;
+};
@@ -0,0 +1,427 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ChannelPrefetcher.h"
+#include "DeepFlattener.h"
+#include "FramebufferModel.h"
+#include "MemoryManager.h"
+
+#include <util/ThreadPool.h>
+
+#include <QCoreApplication>
+
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfInputPart.h>
+#include <OpenEXR/ImfTileDescription.h>
+#include <OpenEXR/ImfTiledInputPart.h>
+
+#include <Imath/ImathBox.h>
+
+#include <algorithm>
+#include <chrono>
+
+std::atomic<size_t> ChannelPrefetcher::s_memoryBudget(size_t(1) << 30);
+
+ChannelPrefetcher::ChannelPrefetcher(ChannelCache& cache)
+  : m_cache(cache)
+  , m_isManaged(false)
+  , m_canceled(false)
+  , m_memoryUsed(0)
+  , m_nextPart(0)
+  , m_pending({-1, 0, {}, {}})
+{}
+
+
+ChannelPrefetcher::~ChannelPrefetcher()
+{
+    stop();
+
+    if (m_isManaged) {
+        MemoryManager::global().remove(this);
+    }
+}
+
+
+void ChannelPrefetcher::setStream(Imf::IStream* stream)
+{
+    stop();
+
+    m_file.reset();
+    m_stream.reset(stream);
+}
+
+
+void ChannelPrefetcher::start()
+{
+    if (!m_stream) {
+        return;
+    }
+
+    // The image is created on a worker thread, the memory manager is only
+    // used from the GUI thread
+    if (!m_isManaged) {
+        MemoryManager::global().add(this);
+        m_isManaged = true;
+    }
+
+    Queue& q = queue();
+
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+
+        m_canceled = false;
+
+        // A running step did not see the cancelation: it queues this
+        // prefetcher again
+        if (
+          q.current == this
+          || std::find(q.waiting.begin(), q.waiting.end(), this)
+               != q.waiting.end()) {
+            return;
+        }
+
+        q.waiting.push_back(this);
+
+        if (q.scheduled) {
+            return;
+        }
+
+        q.scheduled = true;
+    }
+
+    ThreadPool::globalPool().addTask(&ChannelPrefetcher::runQueue);
+}
+
+
+void ChannelPrefetcher::cancel()
+{
+    Queue&                      q = queue();
+    std::lock_guard<std::mutex> lock(q.mutex);
+
+    m_canceled = true;
+
+    q.waiting.erase(
+      std::remove(q.waiting.begin(), q.waiting.end(), this),
+      q.waiting.end());
+}
+
+
+void ChannelPrefetcher::stop()
+{
+    cancel();
+
+    Queue&                       q = queue();
+    std::unique_lock<std::mutex> lock(q.mutex);
+
+    q.stepped.wait(lock, [this, &q]() { return q.current != this; });
+}
+
+
+void ChannelPrefetcher::getPlanes(std::set<const ChannelPlane*>& planes) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (const std::shared_ptr<ChannelPlane>& plane : m_planes) {
+        planes.insert(plane.get());
+    }
+}
+
+
+void ChannelPrefetcher::releasePlanes()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (const std::shared_ptr<ChannelPlane>& plane : m_planes) {
+        m_memoryUsed -= plane->sizeInBytes();
+    }
+
+    m_planes.clear();
+}
+
+
+bool ChannelPrefetcher::isCanceled()
+{
+    Queue&                      q = queue();
+    std::lock_guard<std::mutex> lock(q.mutex);
+
+    return m_canceled;
+}
+
+
+ChannelPrefetcher::Queue& ChannelPrefetcher::queue()
+{
+    // Never destroyed: a prefetching task may still be queued in the global
+    // pool during static destruction
+    static Queue* q = new Queue {{}, {}, {}, nullptr, false};
+
+    return *q;
+}
+
+
+void ChannelPrefetcher::runQueue()
+{
+    Queue& q = queue();
+
+    ChannelPrefetcher* prefetcher = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+
+        // The waiting prefetchers may have been canceled in the meantime
+        if (q.waiting.empty()) {
+            q.scheduled = false;
+            return;
+        }
+
+        prefetcher = q.waiting.front();
+        q.current  = prefetcher;
+        q.waiting.pop_front();
+    }
+
+    const bool hasMore = prefetcher->prefetch();
+
+    bool reschedule = false;
+
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+
+        // Images are prefetched one after the other
+        if (hasMore && !prefetcher->m_canceled) {
+            q.waiting.push_front(prefetcher);
+        }
+
+        q.current   = nullptr;
+        reschedule  = !q.waiting.empty();
+        q.scheduled = reschedule;
+    }
+
+    // The prefetcher may be destroyed as soon as it is not current anymore
+    q.stepped.notify_all();
+
+    if (reschedule) {
+        ThreadPool::globalPool().addTask(&ChannelPrefetcher::runQueue);
+    }
+}
+
+
+bool ChannelPrefetcher::prefetch()
+{
+    try {
+        if (!m_file) {
+            m_file.reset(new Imf::MultiPartInputFile(*m_stream));
+        }
+
+        if (m_pending.partId >= 0) {
+            decodePendingPart(*m_file);
+        } else if (m_nextPart < m_file->parts()) {
+            preparePart(*m_file, m_nextPart++);
+        }
+    } catch (std::exception&) {
+        // The layer will report the error when it is opened
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (const std::shared_ptr<ChannelPlane>& plane : m_pending.planes) {
+            m_memoryUsed -= plane->sizeInBytes();
+        }
+
+        m_pending = {-1, 0, {}, {}};
+    }
+
+    // A file which cannot be opened is tried again on the next start
+    return m_file && (m_pending.partId >= 0 || m_nextPart < m_file->parts());
+}
+
+
+void ChannelPrefetcher::preparePart(
+  Imf::MultiPartInputFile& file, int partId)
+{
+    const Imf::Header& header = file.header(partId);
+
+    if (
+      DeepFlattener::isDeep(header)
+      || (header.hasTileDescription()
+          && header.tileDescription().mode != Imf::ONE_LEVEL)) {
+        return;
+    }
+
+    const Imath::Box2i datW   = header.dataWindow();
+    const int          width  = datW.max.x - datW.min.x + 1;
+    const int          height = datW.max.y - datW.min.y + 1;
+
+    PendingPart pending = {partId, 0, {}, {}};
+
+    for (Imf::ChannelList::ConstIterator it = header.channels().begin();
+         it != header.channels().end();
+         it++) {
+        const Imf::Channel& channel = it.channel();
+
+        // Only full resolution planes are shared
+        if (
+          channel.xSampling != 1 || channel.ySampling != 1
+          || m_cache.find(partId, it.name())) {
+            continue;
+        }
+
+        const size_t planeSize
+          = (size_t)width * height * (channel.type == Imf::HALF ? 2 : 4);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_memoryUsed + planeSize > s_memoryBudget) {
+                continue;
+            }
+
+            m_memoryUsed += planeSize;
+        }
+
+        std::shared_ptr<ChannelPlane> plane
+          = std::make_shared<ChannelPlane>(channel.type, width, height);
+
+        pending.channels.push_back(it.name());
+        pending.planes.push_back(plane);
+    }
+
+    if (!pending.channels.empty()) {
+        m_pending = pending;
+    }
+}
+
+
+void ChannelPrefetcher::decodePendingPart(Imf::MultiPartInputFile& file)
+{
+    dropCachedChannels();
+
+    // All the channels were decoded by models in the meantime
+    if (m_pending.channels.empty()) {
+        m_pending = {-1, 0, {}, {}};
+        return;
+    }
+
+    const int          partId = m_pending.partId;
+    const Imf::Header& header = file.header(partId);
+    const Imath::Box2i datW   = header.dataWindow();
+
+    Imf::FrameBuffer framebuffer;
+
+    for (size_t c = 0; c < m_pending.channels.size(); c++) {
+        framebuffer.insert(
+          m_pending.channels[c],
+          m_pending.planes[c]->slice(datW.min, 1, 1));
+    }
+
+    // Chunks are read one by one, in order, so at most one core decodes
+    // for the prefetcher and it stops quickly when a layer is requested
+    const auto stepEnd
+      = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+
+    const auto isStepOver = [this, &stepEnd]() {
+        return std::chrono::steady_clock::now() >= stepEnd || isCanceled();
+    };
+
+    if (header.hasTileDescription()) {
+        Imf::TiledInputPart part(file, partId);
+        part.setFrameBuffer(framebuffer);
+
+        const int nTilesX = part.numXTiles(0);
+        const int nChunks = nTilesX * part.numYTiles(0);
+
+        for (; m_pending.nextChunk < nChunks; m_pending.nextChunk++) {
+            if (isStepOver()) {
+                return;
+            }
+
+            part.readTile(
+              m_pending.nextChunk % nTilesX,
+              m_pending.nextChunk / nTilesX);
+        }
+    } else {
+        Imf::InputPart part(file, partId);
+        part.setFrameBuffer(framebuffer);
+
+        const int linesPerChunk = FramebufferModel::getLinesPerChunk(header);
+        const int nChunks
+          = (datW.max.y - datW.min.y + linesPerChunk) / linesPerChunk;
+
+        for (; m_pending.nextChunk < nChunks; m_pending.nextChunk++) {
+            if (isStepOver()) {
+                return;
+            }
+
+            const int yStart = datW.min.y + m_pending.nextChunk * linesPerChunk;
+
+            part.readPixels(
+              yStart,
+              std::min(yStart + linesPerChunk - 1, datW.max.y));
+        }
+    }
+
+    // Only fully decoded planes are shared
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t c = 0; c < m_pending.channels.size(); c++) {
+            m_cache.insert(partId, m_pending.channels[c], m_pending.planes[c]);
+            m_planes.push_back(m_pending.planes[c]);
+        }
+    }
+
+    m_pending = {-1, 0, {}, {}};
+
+    // The planes now count in the memory used by the viewer
+    QMetaObject::invokeMethod(
+      QCoreApplication::instance(),
+      []() { MemoryManager::global().update(); },
+      Qt::QueuedConnection);
+}
+
+
+void ChannelPrefetcher::dropCachedChannels()
+{
+    for (size_t c = 0; c < m_pending.channels.size();) {
+        if (!m_cache.find(m_pending.partId, m_pending.channels[c])) {
+            c++;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_memoryUsed -= m_pending.planes[c]->sizeInBytes();
+        }
+
+        m_pending.channels.erase(m_pending.channels.begin() + c);
+        m_pending.planes.erase(m_pending.planes.begin() + c);
+    }
+}
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "ChannelCache.h"
+#include "ChannelPlane.h"
+
+#include <OpenEXR/ImfIO.h>
+#include <OpenEXR/ImfMultiPartInputFile.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+// Decodes in the background the channels of an image not displayed yet and
+// shares them through the channel cache, so opening another layer does not
+// wait for its decoding.
+//
+// The prefetching of all the images is a single task of the global thread
+// pool at a time, which decodes chunks for a few milliseconds before being
+// queued again, leaving the other workers to the displayed layers. The
+// prefetched planes are kept alive by the prefetcher within a memory
+// budget, until the memory manager releases them. Channels of deep parts,
+// of parts streamed by tiles and subsampled channels are not prefetched.
+//
+// The prefetcher opens the file again from its own stream, so it never
+// shares the framebuffer of a part with the models. Images without such a
+// stream e.g., read from the standard input, are not prefetched.
+class ChannelPrefetcher
+{
+  public:
+    ChannelPrefetcher(ChannelCache& cache);
+    ~ChannelPrefetcher();
+
+    ChannelPrefetcher(const ChannelPrefetcher&) = delete;
+    ChannelPrefetcher& operator=(const ChannelPrefetcher&) = delete;
+
+    // Takes the stream the channels are read from. The file is opened by
+    // the first prefetching step.
+    void setStream(Imf::IStream* stream);
+
+    // Starts decoding the channels missing from the cache, or resumes it
+    // where it was canceled
+    void start();
+
+    // Stops decoding after the current chunk without waiting for it. The
+    // chunks already decoded are kept for the next start.
+    void cancel();
+
+    // Cancels and waits for the chunks being decoded. Must be called before
+    // the file is closed.
+    void stop();
+
+    // Adds the planes prefetched so far, which may be shared with models
+    void getPlanes(std::set<const ChannelPlane*>& planes) const;
+
+    // Drops the prefetched planes: they are freed unless a model uses them
+    void releasePlanes();
+
+    // Memory in bytes the prefetched planes of an image can use
+    static size_t getMemoryBudget() { return s_memoryBudget; }
+    static void   setMemoryBudget(size_t bytes) { s_memoryBudget = bytes; }
+
+  private:
+    // Part being decoded, kept when the decoding is canceled
+    struct PendingPart
+    {
+        int partId;
+        int nextChunk;
+
+        std::vector<std::string>                   channels;
+        std::vector<std::shared_ptr<ChannelPlane>> planes;
+    };
+
+    // Prefetchers waiting for the prefetching task, shared by all the
+    // images
+    struct Queue
+    {
+        std::mutex                     mutex;
+        std::condition_variable        stepped;
+        std::deque<ChannelPrefetcher*> waiting;
+        ChannelPrefetcher*             current;
+        bool                           scheduled;
+    };
+
+    static Queue& queue();
+
+    // Prefetching task: runs a step of the first waiting prefetcher and
+    // queues itself again while prefetchers are waiting
+    static void runQueue();
+
+    // Prepares the next part or decodes some chunks of the pending one.
+    // Returns false once the whole file is prefetched.
+    bool prefetch();
+
+    // Allocates the channels of a part fitting in the remaining budget
+    void preparePart(Imf::MultiPartInputFile& file, int partId);
+
+    // Decodes chunks of the pending part until the time slice of the step
+    // is over or the prefetching is canceled
+    void decodePendingPart(Imf::MultiPartInputFile& file);
+
+    // Drops the pending channels a model decoded in the meantime
+    void dropCachedChannels();
+
+    bool isCanceled();
+
+    static std::atomic<size_t> s_memoryBudget;
+
+    ChannelCache& m_cache;
+
+    // Registered to the memory manager once started from the GUI thread
+    bool m_isManaged;
+
+    // Guarded by the queue mutex
+    bool m_canceled;
+
+    // Guards the prefetched planes
+    mutable std::mutex m_mutex;
+
+    std::vector<std::shared_ptr<ChannelPlane>> m_planes;
+
+    // Memory of the prefetched and pending planes
+    size_t m_memoryUsed;
+
+    // Only accessed by the prefetching task once started
+    std::unique_ptr<Imf::IStream>            m_stream;
+    std::unique_ptr<Imf::MultiPartInputFile> m_file;
+
+    int         m_nextPart;
+    PendingPart m_pending;
+};
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ChromaUpsampler.h"
+
+ChromaUpsampler::ChromaUpsampler(int width, int xSampling, int ySampling)
+  : m_width(width)
+  , m_xSampling(xSampling)
+  , m_ySampling(ySampling)
+  , m_sampleWidth((width - 1) / xSampling + 1)
+{}
+
+
+void ChromaUpsampler::upsampleLine(
+  int          y,
+  const float* above,
+  const float* below,
+  float*       samples,
+  float*       line) const
+{
+    // The loops below have no branch and access contiguous samples so they
+    // are vectorized by the compiler
+
+    // Vertical interpolation between the two sample lines
+    const float ty = float(y % m_ySampling) / float(m_ySampling);
+
+    for (int i = 0; i < m_sampleWidth; i++) {
+        samples[i] = above[i] + ty * (below[i] - above[i]);
+    }
+
+    // Past the last sample, the value does not change anymore
+    samples[m_sampleWidth] = samples[m_sampleWidth - 1];
+
+    // Horizontal interpolation, processing the pixels at the same position
+    // relative to their previous sample together
+    for (int k = 0; k < m_xSampling; k++) {
+        const float tx = float(k) / float(m_xSampling);
+        const int   n  = (m_width - k + m_xSampling - 1) / m_xSampling;
+
+        float* out = line + k;
+
+        for (int i = 0; i < n; i++) {
+            out[i * m_xSampling]
+              = samples[i] + tx * (samples[i + 1] - samples[i]);
+        }
+    }
+}
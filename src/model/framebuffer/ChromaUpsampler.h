@@ -0,0 +1,70 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+// Reconstructs full resolution lines of a subsampled channel, such as the
+// RY and BY chroma channels, by bilinear interpolation between its samples.
+//
+// OpenEXR stores the samples of a channel on the pixels whose coordinates
+// are multiples of its sampling rates, the pixels after the last sample of
+// a line or a column take its value.
+class ChromaUpsampler
+{
+  public:
+    ChromaUpsampler(int width, int xSampling, int ySampling);
+
+    int xSampling() const { return m_xSampling; }
+    int ySampling() const { return m_ySampling; }
+
+    // Number of samples in a line
+    int sampleWidth() const { return m_sampleWidth; }
+
+    // Reconstructs the line y from the sample line y / ySampling (`above`)
+    // and the next one (`below`), which is the same past the last sample
+    // line. `samples` is a scratch buffer of sampleWidth() + 1 values.
+    void upsampleLine(
+      int          y,
+      const float* above,
+      const float* below,
+      float*       samples,
+      float*       line) const;
+
+  private:
+    int m_width;
+    int m_xSampling;
+    int m_ySampling;
+    int m_sampleWidth;
+};
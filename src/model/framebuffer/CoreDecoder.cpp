@@ -0,0 +1,283 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "CoreDecoder.h"
+
+#include <util/ThreadPool.h>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+CoreDecoder::CoreDecoder(exr_const_context_t context, int partId)
+  : m_context(context)
+  , m_partId(partId)
+  , m_isTiled(false)
+  , m_chunkWidth(0)
+  , m_chunkHeight(1)
+{
+    exr_storage_t storage;
+    exr_get_storage(context, partId, &storage);
+    exr_get_data_window(context, partId, &m_dataWindow);
+
+    m_isTiled = storage == EXR_STORAGE_TILED;
+
+    if (m_isTiled) {
+        uint32_t              tileW = 1, tileH = 1;
+        exr_tile_level_mode_t levelMode;
+        exr_tile_round_mode_t roundMode;
+
+        exr_get_tile_descriptor(
+          context,
+          partId,
+          &tileW,
+          &tileH,
+          &levelMode,
+          &roundMode);
+
+        m_chunkWidth  = tileW;
+        m_chunkHeight = tileH;
+    } else {
+        int32_t linesPerChunk = 1;
+        exr_get_scanlines_per_chunk(context, partId, &linesPerChunk);
+
+        m_chunkWidth  = m_dataWindow.max.x - m_dataWindow.min.x + 1;
+        m_chunkHeight = linesPerChunk;
+    }
+}
+
+
+bool CoreDecoder::canDecode(
+  exr_const_context_t             context,
+  int                             partId,
+  const std::vector<std::string>& channels)
+{
+    exr_storage_t storage;
+
+    if (exr_get_storage(context, partId, &storage) != EXR_ERR_SUCCESS) {
+        return false;
+    }
+
+    if (storage == EXR_STORAGE_TILED) {
+        uint32_t              tileW, tileH;
+        exr_tile_level_mode_t levelMode;
+        exr_tile_round_mode_t roundMode;
+
+        exr_get_tile_descriptor(
+          context,
+          partId,
+          &tileW,
+          &tileH,
+          &levelMode,
+          &roundMode);
+
+        if (levelMode != EXR_TILE_ONE_LEVEL) {
+            return false;
+        }
+    } else if (storage != EXR_STORAGE_SCANLINE) {
+        return false;
+    }
+
+    const exr_attr_chlist_t* chlist = nullptr;
+
+    if (exr_get_channels(context, partId, &chlist) != EXR_ERR_SUCCESS) {
+        return false;
+    }
+
+    for (int c = 0; c < chlist->num_channels; c++) {
+        const exr_attr_chlist_entry_t& entry = chlist->entries[c];
+
+        if (
+          std::find(channels.begin(), channels.end(), entry.name.str)
+          == channels.end()) {
+            continue;
+        }
+
+        // UINT channels are stored as float in the planes
+        if (
+          entry.pixel_type == EXR_PIXEL_UINT || entry.x_sampling != 1
+          || entry.y_sampling != 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void CoreDecoder::addChannel(const std::string& name, ChannelPlane* plane)
+{
+    m_outputs.push_back({name, plane});
+}
+
+
+void CoreDecoder::readLines(int yStart, int yEnd)
+{
+    const int width = m_dataWindow.max.x - m_dataWindow.min.x + 1;
+
+    // Rows of chunks covering the lines
+    const int rowStart = (yStart - m_dataWindow.min.y) / m_chunkHeight;
+    const int rowEnd   = (yEnd - m_dataWindow.min.y) / m_chunkHeight;
+    const int nColumns = (width + m_chunkWidth - 1) / m_chunkWidth;
+
+    std::vector<Chunk> chunks;
+
+    for (int row = rowStart; row <= rowEnd; row++) {
+        for (int column = 0; column < nColumns; column++) {
+            chunks.push_back({column, row});
+        }
+    }
+
+    std::mutex  errorMutex;
+    std::string error;
+
+    ThreadPool::globalPool().parallelFor(
+      0,
+      chunks.size(),
+      [&](int64_t begin, int64_t end) {
+          const std::string chunkError = decodeChunks(chunks, begin, end);
+
+          if (!chunkError.empty()) {
+              std::lock_guard<std::mutex> lock(errorMutex);
+              error = chunkError;
+          }
+      });
+
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+
+std::string CoreDecoder::decodeChunks(
+  const std::vector<Chunk>& chunks, size_t begin, size_t end)
+{
+    exr_decode_pipeline_t pipeline    = EXR_DECODE_PIPELINE_INITIALIZER;
+    exr_result_t          result      = EXR_ERR_SUCCESS;
+    bool                  initialized = false;
+
+    for (size_t i = begin; result == EXR_ERR_SUCCESS && i < end; i++) {
+        exr_chunk_info_t chunk;
+
+        if (m_isTiled) {
+            result = exr_read_tile_chunk_info(
+              m_context,
+              m_partId,
+              chunks[i].x,
+              chunks[i].y,
+              0,
+              0,
+              &chunk);
+        } else {
+            result = exr_read_scanline_chunk_info(
+              m_context,
+              m_partId,
+              m_dataWindow.min.y + chunks[i].y * m_chunkHeight,
+              &chunk);
+        }
+
+        if (result != EXR_ERR_SUCCESS) {
+            break;
+        }
+
+        // The buffers of the pipeline are reused from one chunk to the next
+        if (!initialized) {
+            result
+              = exr_decoding_initialize(m_context, m_partId, &chunk, &pipeline);
+            initialized = result == EXR_ERR_SUCCESS;
+        } else {
+            result
+              = exr_decoding_update(m_context, m_partId, &chunk, &pipeline);
+        }
+
+        if (result != EXR_ERR_SUCCESS) {
+            break;
+        }
+
+        // Channels without plane are not decoded
+        for (int c = 0; c < pipeline.channel_count; c++) {
+            exr_coding_channel_info_t& channel = pipeline.channels[c];
+
+            channel.decode_to_ptr = nullptr;
+
+            for (const Output& output : m_outputs) {
+                if (output.name != channel.channel_name) {
+                    continue;
+                }
+
+                ChannelPlane* plane = output.plane;
+
+                const bool   isHalf    = plane->type() == Imf::HALF;
+                const size_t pixelSize = isHalf ? sizeof(half) : sizeof(float);
+
+                // From the chunk coordinates: the start of a chunk is not
+                // relative to the data window for tiles
+                const size_t offset
+                  = (size_t)chunks[i].y * m_chunkHeight * plane->width()
+                    + (size_t)chunks[i].x * m_chunkWidth;
+
+                channel.user_data_type
+                  = isHalf ? EXR_PIXEL_HALF : EXR_PIXEL_FLOAT;
+                channel.user_bytes_per_element = pixelSize;
+                channel.user_pixel_stride      = pixelSize;
+                channel.user_line_stride = pixelSize * plane->width();
+
+                uint8_t* data
+                  = isHalf ? reinterpret_cast<uint8_t*>(plane->halfData())
+                           : reinterpret_cast<uint8_t*>(plane->floatData());
+
+                channel.decode_to_ptr = data + offset * pixelSize;
+            }
+        }
+
+        result = exr_decoding_choose_default_routines(
+          m_context,
+          m_partId,
+          &pipeline);
+
+        if (result == EXR_ERR_SUCCESS) {
+            result = exr_decoding_run(m_context, m_partId, &pipeline);
+        }
+    }
+
+    if (initialized) {
+        exr_decoding_destroy(m_context, &pipeline);
+    }
+
+    if (result != EXR_ERR_SUCCESS) {
+        return exr_get_default_error_message(result);
+    }
+
+    return std::string();
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "ChannelPlane.h"
+
+#include <OpenEXR/openexr.h>
+
+#include <string>
+#include <vector>
+
+// Reads a flat part with the OpenEXRCore API: the chunks are decoded
+// concurrently on the thread pool, each one straight into the planes of the
+// framebuffer.
+//
+// Only scanline and single level tiled parts with full resolution HALF or
+// FLOAT channels can be read this way.
+class CoreDecoder
+{
+  public:
+    CoreDecoder(exr_const_context_t context, int partId);
+
+    // The channels of the part can be read with this decoder, missing
+    // channels being ignored
+    static bool canDecode(
+      exr_const_context_t             context,
+      int                             partId,
+      const std::vector<std::string>& channels);
+
+    // Decodes a channel in a plane covering the data window
+    void addChannel(const std::string& name, ChannelPlane* plane);
+
+    // Decodes the chunks covering the lines [yStart, yEnd] of the data
+    // window
+    void readLines(int yStart, int yEnd);
+
+  private:
+    struct Chunk
+    {
+        int x, y;
+    };
+
+    struct Output
+    {
+        std::string   name;
+        ChannelPlane* plane;
+    };
+
+    // Decodes a range of chunks reusing the same pipeline. Returns an error
+    // message, empty on success.
+    std::string
+    decodeChunks(const std::vector<Chunk>& chunks, size_t begin, size_t end);
+
+    exr_const_context_t m_context;
+    int                 m_partId;
+    bool                m_isTiled;
+
+    exr_attr_box2i_t m_dataWindow;
+
+    // Lines of a scanline chunk or size of the tiles
+    int m_chunkWidth, m_chunkHeight;
+
+    std::vector<Output> m_outputs;
+};
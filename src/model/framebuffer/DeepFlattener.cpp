@@ -0,0 +1,415 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "DeepFlattener.h"
+
+#include <util/ThreadPool.h>
+
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfDeepFrameBuffer.h>
+#include <OpenEXR/ImfDeepImageStateAttribute.h>
+#include <OpenEXR/ImfPartType.h>
+
+#include <algorithm>
+#include <numeric>
+
+const size_t DeepFlattener::s_maxSamples = size_t(1) << 24;
+
+DeepFlattener::DeepFlattener(Imf::MultiPartInputFile& file, int partId)
+  : m_dataWindow(file.header(partId).dataWindow())
+  , m_width(m_dataWindow.max.x - m_dataWindow.min.x + 1)
+  , m_fileChannels(file.header(partId).channels())
+  , m_sampleCountPlane(nullptr)
+  , m_depthChannel(-1)
+  , m_bandStart(0)
+{
+    const Imf::Header& header = file.header(partId);
+
+    if (header.type() == Imf::DEEPTILE) {
+        m_tiledPart.reset(new Imf::DeepTiledInputPart(file, partId));
+    } else {
+        m_scanLinePart.reset(new Imf::DeepScanLineInputPart(file, partId));
+    }
+
+    const Imf::DeepImageStateAttribute* state
+      = header.findTypedAttribute<Imf::DeepImageStateAttribute>(
+        "deepImageState");
+
+    const bool sorted = state
+                        && (state->value() == Imf::DIS_SORTED
+                            || state->value() == Imf::DIS_TIDY);
+
+    if (!sorted && m_fileChannels.findChannel("Z")) {
+        m_depthChannel = getChannelIndex("Z");
+    }
+}
+
+
+bool DeepFlattener::isDeep(const Imf::Header& header)
+{
+    return header.hasType() && Imf::isDeepData(header.type());
+}
+
+
+void DeepFlattener::addChannel(const std::string& name, ChannelPlane* plane)
+{
+    const Imf::Channel* channel = m_fileChannels.findChannel(name);
+
+    const std::string leafName = name.substr(name.find_last_of('.') + 1);
+
+    Output output;
+    output.plane   = plane;
+    output.channel = getChannelIndex(name);
+    output.alpha   = -1;
+
+    if (leafName == "A") {
+        output.mode = Compositing_Alpha;
+    } else if (
+      leafName == "Z" || leafName == "ZBack"
+      || (channel && channel->type == Imf::UINT)) {
+        output.mode = Compositing_Front;
+    } else {
+        output.mode = Compositing_Over;
+
+        const std::string alpha = getAlphaName(name);
+
+        if (!alpha.empty()) {
+            output.alpha = getChannelIndex(alpha);
+        }
+    }
+
+    m_outputs.push_back(output);
+}
+
+
+void DeepFlattener::setSampleCountPlane(ChannelPlane* plane)
+{
+    m_sampleCountPlane = plane;
+}
+
+
+void DeepFlattener::readLines(int yStart, int yEnd)
+{
+    const int tileH = m_tiledPart ? m_tiledPart->tileYSize() : 1;
+
+    // Tiled parts are read by whole rows of tiles
+    const int ty0 = (yStart - m_dataWindow.min.y) / tileH;
+    const int ty1 = (yEnd - m_dataWindow.min.y) / tileH;
+
+    yStart = m_dataWindow.min.y + ty0 * tileH;
+    yEnd   = std::min(
+      m_dataWindow.min.y + (ty1 + 1) * tileH - 1,
+      m_dataWindow.max.y);
+
+    const size_t nPixels = (size_t)(yEnd - yStart + 1) * m_width;
+
+    m_bandStart = yStart;
+    m_sampleCounts.assign(nPixels, 0);
+    m_pointers.resize(m_channels.size());
+    m_samples.resize(m_channels.size());
+
+    for (std::vector<char*>& pointers : m_pointers) {
+        pointers.assign(nPixels, nullptr);
+    }
+
+    // Slices of the band, positioned in the data window
+    const ptrdiff_t firstPixel
+      = (ptrdiff_t)m_dataWindow.min.x + (ptrdiff_t)yStart * m_width;
+
+    Imf::DeepFrameBuffer framebuffer;
+
+    framebuffer.insertSampleCountSlice(Imf::Slice(
+      Imf::UINT,
+      (char*)(m_sampleCounts.data() - firstPixel),
+      sizeof(unsigned int),
+      sizeof(unsigned int) * m_width));
+
+    for (size_t c = 0; c < m_channels.size(); c++) {
+        framebuffer.insert(
+          m_channels[c],
+          Imf::DeepSlice(
+            Imf::FLOAT,
+            (char*)(m_pointers[c].data() - firstPixel),
+            sizeof(char*),
+            sizeof(char*) * m_width,
+            sizeof(float)));
+    }
+
+    if (m_tiledPart) {
+        const int tileW  = m_tiledPart->tileXSize();
+        const int nTiles = m_tiledPart->numXTiles(0);
+
+        m_tiledPart->setFrameBuffer(framebuffer);
+        m_tiledPart->readPixelSampleCounts(0, nTiles - 1, ty0, ty1);
+
+        for (int ty = ty0; ty <= ty1; ty++) {
+            const int y0 = m_dataWindow.min.y + ty * tileH;
+            const int y1 = std::min(y0 + tileH - 1, m_dataWindow.max.y);
+
+            // Consecutive tiles are read together while their samples fit
+            // in memory
+            int tx = 0;
+
+            while (tx < nTiles) {
+                int    txEnd   = tx;
+                size_t samples = 0;
+
+                for (; txEnd < nTiles; txEnd++) {
+                    const Imath::Box2i tile
+                      = m_tiledPart->dataWindowForTile(txEnd, ty, 0);
+
+                    size_t tileSamples = 0;
+
+                    for (int y = tile.min.y; y <= tile.max.y; y++) {
+                        const size_t offset
+                          = (size_t)(y - yStart) * m_width
+                            - m_dataWindow.min.x;
+
+                        for (int x = tile.min.x; x <= tile.max.x; x++) {
+                            tileSamples += m_sampleCounts[offset + x];
+                        }
+                    }
+
+                    if (txEnd > tx && samples + tileSamples > s_maxSamples) {
+                        break;
+                    }
+
+                    samples += tileSamples;
+                }
+
+                const int x0 = m_dataWindow.min.x + tx * tileW;
+                const int x1
+                  = std::min(x0 + (txEnd - tx) * tileW - 1, m_dataWindow.max.x);
+
+                readRegion(x0, x1, y0, y1, [this, tx, txEnd, ty]() {
+                    m_tiledPart->readTiles(tx, txEnd - 1, ty, ty);
+                });
+
+                tx = txEnd;
+            }
+        }
+    } else {
+        m_scanLinePart->setFrameBuffer(framebuffer);
+        m_scanLinePart->readPixelSampleCounts(yStart, yEnd);
+
+        // Consecutive lines are read together while their samples fit in
+        // memory
+        int y = yStart;
+
+        while (y <= yEnd) {
+            int    y1      = y;
+            size_t samples = 0;
+
+            for (; y1 <= yEnd; y1++) {
+                const unsigned int* counts
+                  = &m_sampleCounts[(size_t)(y1 - yStart) * m_width];
+
+                const size_t lineSamples
+                  = std::accumulate(counts, counts + m_width, size_t(0));
+
+                if (y1 > y && samples + lineSamples > s_maxSamples) {
+                    break;
+                }
+
+                samples += lineSamples;
+            }
+
+            readRegion(
+              m_dataWindow.min.x,
+              m_dataWindow.max.x,
+              y,
+              y1 - 1,
+              [this, y, y1]() { m_scanLinePart->readPixels(y, y1 - 1); });
+
+            y = y1;
+        }
+    }
+}
+
+
+int DeepFlattener::getChannelIndex(const std::string& name)
+{
+    auto it = std::find(m_channels.begin(), m_channels.end(), name);
+
+    if (it != m_channels.end()) {
+        return int(it - m_channels.begin());
+    }
+
+    m_channels.push_back(name);
+
+    return int(m_channels.size()) - 1;
+}
+
+
+std::string DeepFlattener::getAlphaName(const std::string& name) const
+{
+    // Alpha of the same layer, or the default one
+    const size_t      separator = name.find_last_of('.');
+    const std::string layerAlpha
+      = separator == std::string::npos ? "A"
+                                       : name.substr(0, separator + 1) + "A";
+
+    if (m_fileChannels.findChannel(layerAlpha)) {
+        return layerAlpha;
+    }
+
+    if (m_fileChannels.findChannel("A")) {
+        return "A";
+    }
+
+    return std::string();
+}
+
+
+void DeepFlattener::readRegion(
+  int                          xStart,
+  int                          xEnd,
+  int                          yStart,
+  int                          yEnd,
+  const std::function<void()>& read)
+{
+    // Position of the pixel x of the line y in the band
+    auto bandIndex = [this](int x, int y) {
+        return (size_t)(y - m_bandStart) * m_width + (x - m_dataWindow.min.x);
+    };
+
+    size_t nSamples = 0;
+
+    for (int y = yStart; y <= yEnd; y++) {
+        for (int x = xStart; x <= xEnd; x++) {
+            nSamples += m_sampleCounts[bandIndex(x, y)];
+        }
+    }
+
+    for (size_t c = 0; c < m_channels.size(); c++) {
+        m_samples[c].resize(nSamples);
+
+        char* samples = (char*)m_samples[c].data();
+
+        for (int y = yStart; y <= yEnd; y++) {
+            for (int x = xStart; x <= xEnd; x++) {
+                const size_t i = bandIndex(x, y);
+
+                m_pointers[c][i] = samples;
+                samples += m_sampleCounts[i] * sizeof(float);
+            }
+        }
+    }
+
+    read();
+
+    ThreadPool::globalPool().parallelFor(
+      yStart,
+      yEnd + 1,
+      [&](int64_t y0, int64_t y1) {
+          std::vector<int> order;
+
+          for (int y = y0; y < y1; y++) {
+              const size_t planeOffset
+                = (size_t)(y - m_dataWindow.min.y) * m_width
+                  - m_dataWindow.min.x;
+
+              for (int x = xStart; x <= xEnd; x++) {
+                  flattenPixel(bandIndex(x, y), planeOffset + x, order);
+              }
+          }
+      },
+      4);
+}
+
+
+void DeepFlattener::flattenPixel(
+  size_t bandIndex, size_t planeIndex, std::vector<int>& order) const
+{
+    const int nSamples = (int)m_sampleCounts[bandIndex];
+
+    if (m_sampleCountPlane) {
+        m_sampleCountPlane->setValue(planeIndex, (float)nSamples);
+    }
+
+    // Front to back order of the samples
+    order.resize(nSamples);
+    std::iota(order.begin(), order.end(), 0);
+
+    if (m_depthChannel >= 0 && nSamples > 1) {
+        const float* depth
+          = (const float*)m_pointers[m_depthChannel][bandIndex];
+
+        std::stable_sort(order.begin(), order.end(), [depth](int a, int b) {
+            return depth[a] < depth[b];
+        });
+    }
+
+    for (const Output& output : m_outputs) {
+        const float* values = (const float*)m_pointers[output.channel][bandIndex];
+        const float* alpha
+          = output.alpha >= 0
+              ? (const float*)m_pointers[output.alpha][bandIndex]
+              : nullptr;
+
+        float value = 0.f;
+
+        switch (output.mode) {
+            case Compositing_Over: {
+                float transmittance = 1.f;
+
+                for (int s : order) {
+                    value += transmittance * values[s];
+                    transmittance *= 1.f - (alpha ? alpha[s] : 1.f);
+
+                    if (transmittance <= 0.f) {
+                        break;
+                    }
+                }
+            } break;
+
+            case Compositing_Alpha: {
+                float transmittance = 1.f;
+
+                for (int s : order) {
+                    transmittance *= 1.f - values[s];
+                }
+
+                value = 1.f - transmittance;
+            } break;
+
+            case Compositing_Front:
+                if (nSamples > 0) {
+                    value = values[order[0]];
+                }
+                break;
+        }
+
+        output.plane->setValue(planeIndex, value);
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include "ChannelPlane.h"
+
+#include <OpenEXR/ImfDeepScanLineInputPart.h>
+#include <OpenEXR/ImfDeepTiledInputPart.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfMultiPartInputFile.h>
+
+#include <Imath/ImathBox.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reads a deep part and composites the samples of each pixel front to back
+// into flat planes.
+//
+// The part is read by bands of lines: only the samples of a band are kept
+// in memory, a band having too many samples is itself read in smaller
+// regions.
+class DeepFlattener
+{
+  public:
+    DeepFlattener(Imf::MultiPartInputFile& file, int partId);
+
+    static bool isDeep(const Imf::Header& header);
+
+    // Flattens a channel in a plane covering the data window
+    void addChannel(const std::string& name, ChannelPlane* plane);
+
+    // Stores the number of samples of each pixel in a plane covering the
+    // data window
+    void setSampleCountPlane(ChannelPlane* plane);
+
+    // Reads and flattens the lines [yStart, yEnd] of the data window. Tiled
+    // parts are read by whole rows of tiles.
+    void readLines(int yStart, int yEnd);
+
+  private:
+    enum CompositingMode
+    {
+        // Premultiplied value composited over the next samples
+        Compositing_Over,
+        // Coverage of the samples
+        Compositing_Alpha,
+        // Value of the front sample, e.g. depth or ids
+        Compositing_Front,
+    };
+
+    struct Output
+    {
+        ChannelPlane*   plane;
+        int             channel;
+        int             alpha;
+        CompositingMode mode;
+    };
+
+    // Index of a channel in the channels to read
+    int getChannelIndex(const std::string& name);
+
+    // Alpha channel associated with a channel, empty if there is none
+    std::string getAlphaName(const std::string& name) const;
+
+    // Allocates the samples of the pixels of a region of the current band,
+    // reads them and flattens them
+    void readRegion(
+      int                          xStart,
+      int                          xEnd,
+      int                          yStart,
+      int                          yEnd,
+      const std::function<void()>& read);
+
+    void flattenPixel(
+      size_t bandIndex, size_t planeIndex, std::vector<int>& order) const;
+
+    // Maximum number of samples of a channel kept in memory
+    static const size_t s_maxSamples;
+
+    Imath::Box2i m_dataWindow;
+    int          m_width;
+
+    const Imf::ChannelList& m_fileChannels;
+
+    std::unique_ptr<Imf::DeepScanLineInputPart> m_scanLinePart;
+    std::unique_ptr<Imf::DeepTiledInputPart>     m_tiledPart;
+
+    std::vector<std::string> m_channels;
+    std::vector<Output>      m_outputs;
+    ChannelPlane*            m_sampleCountPlane;
+
+    // Samples are sorted by depth unless the file tells they already are
+    int m_depthChannel;
+
+    // Sample counts and pointers to the samples of each channel for the
+    // pixels of the current band
+    int                             m_bandStart;
+    std::vector<unsigned int>       m_sampleCounts;
+    std::vector<std::vector<char*>> m_pointers;
+    std::vector<std::vector<float>> m_samples;
+};
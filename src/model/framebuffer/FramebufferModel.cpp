@@ -31,22 +31,80 @@
  */
 
 #include "FramebufferModel.h"
+#include "CoreDecoder.h"
+#include "MemoryManager.h"
 
+#include <util/ThreadPool.h>
+
+#include <OpenEXR/ImfCompression.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfInputPart.h>
+#include <OpenEXR/ImfPreviewImage.h>
+#include <OpenEXR/ImfTileDescription.h>
+#include <OpenEXR/ImfTiledInputPart.h>
+
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+
+std::atomic<FramebufferModel::DecodeBackend>
+  FramebufferModel::s_decodeBackend(FramebufferModel::Decode_OpenEXR);
+
+std::atomic<bool> FramebufferModel::s_logDecodeTime(false);
+
+std::atomic<bool> FramebufferModel::s_showProxy(true);
+
+const int64_t FramebufferModel::s_proxyMinPixels = int64_t(1) << 22;
+
+const int FramebufferModel::s_proxyMinLines = 8;
+const int FramebufferModel::s_proxyMaxLines = 64;
+
+const int64_t FramebufferModel::s_previewPixels = int64_t(1) << 20;
+
+const int FramebufferModel::s_conversionTileSize = 64;
 
 FramebufferModel::FramebufferModel(QObject* parent)
   : QObject(parent)
   , m_width(0)
   , m_height(0)
   , m_isImageLoaded(false)
+  , m_progressiveLoading(true)
   , m_exposure(0)
   , m_imageLoadingWatcher(new QFutureWatcher<void>(this))
   , m_imageEditingWatcher(new QFutureWatcher<void>(this))
   , m_pixelAspectRatio(1.f)
-{}
+  , m_channelCache(nullptr)
+  , m_coreContext(nullptr)
+  , m_imageLevel(0)
+  , m_bufferLevel(0)
+  , m_file(nullptr)
+  , m_partID(-1)
+  , m_tiledFile(nullptr)
+  , m_tiledPartID(-1)
+  , m_requestedLevel(-1)
+  , m_tiledRequest(0)
+  , m_loadingCanceled(false)
+  , m_isVisible(false)
+  , m_isEvicted(false)
+{
+    QObject::connect(
+      m_imageLoadingWatcher,
+      SIGNAL(finished()),
+      this,
+      SIGNAL(loadFinished()));
+
+    QObject::connect(
+      m_imageLoadingWatcher,
+      SIGNAL(finished()),
+      this,
+      SLOT(onLoadFinished()));
+
+    MemoryManager::global().add(this);
+}
 
 QRect FramebufferModel::getDisplayWindow() const
 {
@@ -58,4 +116,663 @@ QRect FramebufferModel::getDataWindow() const
     return m_dataWindow;
 }
 
-FramebufferModel::~FramebufferModel() {}
+FramebufferModel::~FramebufferModel()
+{
+    MemoryManager::global().remove(this);
+}
+
+
+void FramebufferModel::cancelLoading()
+{
+    m_loadingCanceled = true;
+
+    abandonLoadings();
+
+    m_imageEditingWatcher->cancel();
+    m_imageEditingWatcher->waitForFinished();
+}
+
+
+int FramebufferModel::abandonLoadings()
+{
+    const int requestId = ++m_tiledRequest;
+
+    for (QFuture<void>& loading : m_loadings) {
+        loading.waitForFinished();
+    }
+
+    m_loadings.clear();
+
+    return requestId;
+}
+
+
+void FramebufferModel::switchFile(
+  Imf::MultiPartInputFile& file,
+  ChannelCache*            cache,
+  exr_const_context_t      coreContext,
+  bool                     partChanged)
+{
+    const bool wasLoading = isLoading();
+
+    abandonLoadings();
+
+    m_file        = &file;
+    m_coreContext = coreContext;
+
+    if (m_channelCache) {
+        m_channelCache = cache;
+    }
+
+    if (!partChanged && !wasLoading && m_isImageLoaded) {
+        if (m_tiledFile) {
+            m_tiledFile = &file;
+        }
+
+        return;
+    }
+
+    m_levelSizes.clear();
+    m_tiledFile = nullptr;
+    m_isEvicted = false;
+
+    reload();
+}
+
+
+bool FramebufferModel::canEvict() const
+{
+    return !m_isVisible && !m_isEvicted && m_isImageLoaded && m_file
+           && !isTiledStreaming() && !isLoading();
+}
+
+
+void FramebufferModel::evict()
+{
+    if (!canEvict()) {
+        return;
+    }
+
+    // Conversions read the planes
+    m_imageEditingWatcher->cancel();
+    m_imageEditingWatcher->waitForFinished();
+
+    releasePixels();
+    m_bufferRegion = QRect();
+
+    // The preview is displayed as a coarser level of the image
+    int levels = 0;
+
+    while ((int64_t)(m_image.width() >> levels) * (m_image.height() >> levels)
+           > s_previewPixels) {
+        levels++;
+    }
+
+    if (levels > 0) {
+        m_image = m_image.scaled(
+          std::max(1, m_image.width() >> levels),
+          std::max(1, m_image.height() >> levels),
+          Qt::IgnoreAspectRatio,
+          Qt::SmoothTransformation);
+
+        m_imageLevel += levels;
+        m_imageRegion = QRect(
+          m_imageRegion.x() >> levels,
+          m_imageRegion.y() >> levels,
+          m_image.width(),
+          m_image.height());
+    }
+
+    m_isEvicted = true;
+
+    emit imageChanged();
+}
+
+
+void FramebufferModel::setVisible(bool visible)
+{
+    m_isVisible = visible;
+
+    if (visible) {
+        MemoryManager::global().touch(this);
+
+        if (m_isEvicted) {
+            m_isEvicted = false;
+            reload();
+        }
+    }
+
+    MemoryManager::global().update();
+}
+
+
+size_t FramebufferModel::getImageMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(m_memoryMutex);
+    return m_image.sizeInBytes();
+}
+
+
+bool FramebufferModel::isLoading() const
+{
+    for (const QFuture<void>& loading : m_loadings) {
+        if (!loading.isFinished()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void FramebufferModel::onLoadFinished()
+{
+    MemoryManager::global().update();
+}
+
+
+bool FramebufferModel::isCoreDecoded(
+  int partId, const std::vector<std::string>& channels) const
+{
+    return s_decodeBackend == Decode_OpenEXRCore && m_coreContext
+           && CoreDecoder::canDecode(m_coreContext, partId, channels);
+}
+
+
+void FramebufferModel::logDecodeTime(
+  int partId, bool coreDecoded, qint64 milliseconds) const
+{
+    if (s_logDecodeTime) {
+        std::cout << "Part " << partId << " decoded in " << milliseconds
+                  << " ms with " << (coreDecoded ? "OpenEXRCore" : "OpenEXR")
+                  << std::endl;
+    }
+}
+
+
+bool FramebufferModel::isProxyShown() const
+{
+    return s_showProxy && (int64_t)m_width * m_height >= s_proxyMinPixels;
+}
+
+
+bool FramebufferModel::showPreviewImage(const Imf::Header& header)
+{
+    if (!header.hasPreviewImage()) {
+        return false;
+    }
+
+    const Imf::PreviewImage& preview = header.previewImage();
+
+    if (preview.width() == 0 || preview.height() == 0 || m_image.isNull()) {
+        return false;
+    }
+
+    // Preview pixels are stored as 8 bits RGBA
+    const QImage previewImage(
+      reinterpret_cast<const uchar*>(preview.pixels()),
+      preview.width(),
+      preview.height(),
+      preview.width() * sizeof(Imf::PreviewRgba),
+      QImage::Format_RGBA8888);
+
+    const QImage scaled
+      = previewImage
+          .scaled(
+            m_image.size(),
+            Qt::IgnoreAspectRatio,
+            Qt::SmoothTransformation)
+          .convertToFormat(m_image.format());
+
+    // Copied in place as the view may be displaying the image
+    unsigned char* const bits         = m_image.bits();
+    const size_t         bytesPerLine = m_image.bytesPerLine();
+
+    for (int y = 0; y < m_image.height(); y++) {
+        std::memcpy(
+          bits + y * bytesPerLine,
+          scaled.constScanLine(y),
+          std::min(bytesPerLine, (size_t)scaled.bytesPerLine()));
+    }
+
+    emit imageRegionChanged(QRect(QPoint(0, 0), m_image.size()));
+
+    return true;
+}
+
+
+bool FramebufferModel::showSampledLines(
+  const Imf::Header&              header,
+  int                             requestId,
+  const std::function<void(int)>& readLine,
+  const std::function<void(int)>& convertLine)
+{
+    const int height        = m_image.height();
+    const int linesPerChunk = getLinesPerChunk(header);
+    const int nChunks       = (m_height + linesPerChunk - 1) / linesPerChunk;
+
+    // Each sampled line decodes a whole chunk, so at most a quarter of the
+    // chunks are decoded twice
+    const int nLines = std::min(std::min(s_proxyMaxLines, height), nChunks / 4);
+
+    if (nLines < s_proxyMinLines) {
+        return true;
+    }
+
+    unsigned char* const bits         = m_image.bits();
+    const size_t         bytesPerLine = m_image.bytesPerLine();
+
+    for (int i = 0; i < nLines; i++) {
+        if (isLoadingAbandoned(requestId)) {
+            return false;
+        }
+
+        const int y0 = (int64_t)i * height / nLines;
+        const int y1 = (int64_t)(i + 1) * height / nLines;
+
+        readLine(getBufferLine(y0));
+        convertLine(y0);
+
+        for (int y = y0 + 1; y < y1; y++) {
+            std::memcpy(
+              bits + y * bytesPerLine,
+              bits + y0 * bytesPerLine,
+              bytesPerLine);
+        }
+
+        emit imageRegionChanged(QRect(0, y0, m_image.width(), y1 - y0));
+    }
+
+    return true;
+}
+
+
+void FramebufferModel::addLoading(const QFuture<void>& loading)
+{
+    // Forget the loads already done
+    for (int i = m_loadings.size() - 1; i >= 0; i--) {
+        if (m_loadings[i].isFinished()) {
+            m_loadings.removeAt(i);
+        }
+    }
+
+    m_loadings.append(loading);
+    m_imageLoadingWatcher->setFuture(loading);
+}
+
+
+void FramebufferModel::setVisibleRegion(const QRect& region, double zoom)
+{
+    m_visibleRegion = region;
+
+    if (!isTiledStreaming() || region.isEmpty()) {
+        return;
+    }
+
+    // Use the coarsest level still giving at least one pixel per screen pixel
+    int level = 0;
+
+    while (level + 1 < (int)m_levelSizes.size()
+           && std::ldexp(zoom, level + 1) <= 1.) {
+        level++;
+    }
+
+    const QSize levelSize = m_levelSizes[level];
+    const int   scale     = 1 << level;
+    const int   tileW     = m_tileSize.width();
+    const int   tileH     = m_tileSize.height();
+
+    // Visible tiles of the level with a margin of one tile so small pans do
+    // not trigger a new read
+    const int x0 = std::max(0, region.left() / scale / tileW - 1) * tileW;
+    const int y0 = std::max(0, region.top() / scale / tileH - 1) * tileH;
+    const int x1 = std::min(
+      levelSize.width(),
+      (region.right() / scale / tileW + 2) * tileW);
+    const int y1 = std::min(
+      levelSize.height(),
+      (region.bottom() / scale / tileH + 2) * tileH);
+
+    const QRect levelRegion(x0, y0, x1 - x0, y1 - y0);
+
+    if (levelRegion.isEmpty()) {
+        return;
+    }
+
+    if (level == m_requestedLevel && m_requestedRegion.contains(levelRegion)) {
+        return;
+    }
+
+    m_requestedLevel  = level;
+    m_requestedRegion = levelRegion;
+
+    loadTiledRegion(level, levelRegion);
+}
+
+
+void FramebufferModel::loadRegion(const QRect& region)
+{
+    // Streamed parts already read only the visible tiles
+    if (!m_file || isTiledStreaming()) {
+        return;
+    }
+
+    const QRect dataRegion(0, 0, m_width, m_height);
+    const QRect readRegion
+      = region.isNull() ? dataRegion : region.intersected(dataRegion);
+
+    if (readRegion.isEmpty()) {
+        return;
+    }
+
+    // Align the region on the pixels of the level it is displayed at
+    const int level = getDisplayLevel(readRegion.width(), readRegion.height());
+    const int scale = 1 << level;
+
+    const int x0 = readRegion.left() / scale * scale;
+    const int y0 = readRegion.top() / scale * scale;
+    const int x1
+      = std::min(m_width, (readRegion.right() / scale + 1) * scale);
+    const int y1
+      = std::min(m_height, (readRegion.bottom() / scale + 1) * scale);
+
+    loadDataRegion(level, QRect(x0, y0, x1 - x0, y1 - y0));
+}
+
+
+int64_t FramebufferModel::getBufferIndex(int x, int y) const
+{
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+        return -1;
+    }
+
+    const int levelX = x >> m_bufferLevel;
+    const int levelY = y >> m_bufferLevel;
+
+    if (!m_bufferRegion.contains(levelX, levelY)) {
+        return -1;
+    }
+
+    return (int64_t)(levelY - m_bufferRegion.y()) * m_bufferRegion.width()
+           + (levelX - m_bufferRegion.x());
+}
+
+
+int FramebufferModel::getDisplayLevel(int width, int height)
+{
+    // Keep the displayed image within 1 GB for 32 bits pixels
+    const int64_t maxImagePixels = int64_t(1) << 28;
+
+    int level = 0;
+
+    while ((int64_t)(width >> level) * (height >> level) > maxImagePixels) {
+        level++;
+    }
+
+    return level;
+}
+
+
+void FramebufferModel::initImage(QImage::Format format)
+{
+    const int level = getDisplayLevel(m_width, m_height);
+
+    m_bufferLevel  = 0;
+    m_bufferRegion = QRect(0, 0, m_width, m_height);
+
+    m_imageLevel  = level;
+    m_imageRegion = QRect(0, 0, m_width >> level, m_height >> level);
+
+    const QImage image(m_imageRegion.width(), m_imageRegion.height(), format);
+
+    std::lock_guard<std::mutex> lock(m_memoryMutex);
+    m_image = image;
+}
+
+
+bool FramebufferModel::readRegionBands(
+  const QRect&                                                region,
+  int                                                         requestId,
+  const std::function<void(Imf::FrameBuffer&, const QRect&)>& insertSlices,
+  const std::function<void(const QRect&)>&                    copyBand)
+{
+    const Imf::Header&  header = m_file->header(m_partID);
+    const Imath::Box2i& datW   = header.dataWindow();
+
+    const QRect dataRegion(
+      0,
+      0,
+      datW.max.x - datW.min.x + 1,
+      datW.max.y - datW.min.y + 1);
+
+    if (header.hasTileDescription()) {
+        // Only the tiles covering the region are read, by rows of tiles
+        Imf::TiledInputPart part(*m_file, m_partID);
+
+        const int tileW = part.tileXSize();
+        const int tileH = part.tileYSize();
+
+        const int tx0 = region.left() / tileW;
+        const int tx1 = region.right() / tileW;
+        const int ty0 = region.top() / tileH;
+        const int ty1 = region.bottom() / tileH;
+
+        for (int ty = ty0; ty <= ty1; ty++) {
+            if (isLoadingAbandoned(requestId)) {
+                return false;
+            }
+
+            const QRect band
+              = QRect(tx0 * tileW, ty * tileH, (tx1 - tx0 + 1) * tileW, tileH)
+                  .intersected(dataRegion);
+
+            Imf::FrameBuffer framebuffer;
+            insertSlices(framebuffer, band);
+
+            part.setFrameBuffer(framebuffer);
+            part.readTiles(tx0, tx1, ty, ty);
+
+            copyBand(band);
+        }
+    } else {
+        // Scanlines are always decoded on the whole width of the data
+        // window, only the lines of the region are read
+        Imf::InputPart part(*m_file, m_partID);
+
+        const int bandHeight = getBandHeight(header);
+
+        for (int y = region.top() / bandHeight * bandHeight;
+             y <= region.bottom();
+             y += bandHeight) {
+            if (isLoadingAbandoned(requestId)) {
+                return false;
+            }
+
+            const int yStart = std::max(y, region.top());
+            const int yEnd   = std::min(y + bandHeight - 1, region.bottom());
+
+            const QRect band(0, yStart, dataRegion.width(), yEnd - yStart + 1);
+
+            Imf::FrameBuffer framebuffer;
+            insertSlices(framebuffer, band);
+
+            part.setFrameBuffer(framebuffer);
+            part.readPixels(datW.min.y + yStart, datW.min.y + yEnd);
+
+            copyBand(band);
+        }
+    }
+
+    return true;
+}
+
+
+bool FramebufferModel::convertImageTiles(
+  const std::function<void(const QRect&)>& convertTile,
+  const QRect&                             firstRegion)
+{
+    const QRect imageRect(QPoint(0, 0), m_image.size());
+    const int   tileSize = s_conversionTileSize;
+
+    std::vector<QRect> firstTiles;
+    std::vector<QRect> otherTiles;
+    QRect              firstTilesRect;
+
+    for (int y = 0; y < imageRect.height(); y += tileSize) {
+        for (int x = 0; x < imageRect.width(); x += tileSize) {
+            const QRect tile
+              = QRect(x, y, tileSize, tileSize).intersected(imageRect);
+
+            if (tile.intersects(firstRegion)) {
+                firstTiles.push_back(tile);
+                firstTilesRect |= tile;
+            } else {
+                otherTiles.push_back(tile);
+            }
+        }
+    }
+
+    // Tiles are small enough for a new conversion to start right away
+    // when this one is canceled
+    auto convertTiles = [&](const std::vector<QRect>& tiles) -> bool {
+        ThreadPool::globalPool().parallelFor(
+          0,
+          (int64_t)tiles.size(),
+          [&](int64_t t0, int64_t t1) {
+              for (int64_t t = t0; t < t1; t++) {
+                  if (m_imageEditingWatcher->isCanceled()) {
+                      return;
+                  }
+
+                  convertTile(tiles[t]);
+              }
+          });
+
+        return !m_imageEditingWatcher->isCanceled();
+    };
+
+    if (!firstTiles.empty()) {
+        if (!convertTiles(firstTiles)) {
+            return false;
+        }
+
+        emit imageRegionChanged(firstTilesRect);
+    }
+
+    return convertTiles(otherTiles);
+}
+
+
+QRect FramebufferModel::getVisibleImageRect() const
+{
+    if (m_visibleRegion.isEmpty()) {
+        return QRect();
+    }
+
+    // The visible region at the level of the image
+    const QRect levelRegion(
+      QPoint(
+        m_visibleRegion.left() >> m_imageLevel,
+        m_visibleRegion.top() >> m_imageLevel),
+      QPoint(
+        m_visibleRegion.right() >> m_imageLevel,
+        m_visibleRegion.bottom() >> m_imageLevel));
+
+    return levelRegion.translated(-m_imageRegion.x(), -m_imageRegion.y())
+      .intersected(QRect(QPoint(0, 0), m_image.size()));
+}
+
+
+int FramebufferModel::getBufferLine(int y) const
+{
+    return ((y + m_imageRegion.y()) << (m_imageLevel - m_bufferLevel))
+           - m_bufferRegion.y();
+}
+
+
+bool FramebufferModel::initTiledStreaming(
+  Imf::MultiPartInputFile& file, int partId)
+{
+    const Imf::Header& header = file.header(partId);
+
+    if (
+      !header.hasTileDescription()
+      || header.tileDescription().mode == Imf::ONE_LEVEL
+      || (header.hasType() && header.type() == Imf::DEEPTILE)) {
+        return false;
+    }
+
+    Imf::TiledInputPart part(file, partId);
+
+    // Ripmaps are only read along their diagonal
+    const int nLevels = std::min(part.numXLevels(), part.numYLevels());
+
+    m_levelSizes.clear();
+
+    for (int l = 0; l < nLevels; l++) {
+        m_levelSizes.push_back(QSize(part.levelWidth(l), part.levelHeight(l)));
+    }
+
+    m_tileSize    = QSize(part.tileXSize(), part.tileYSize());
+    m_tiledFile   = &file;
+    m_tiledPartID = partId;
+
+    m_requestedLevel  = -1;
+    m_requestedRegion = QRect();
+
+    return true;
+}
+
+
+int FramebufferModel::getLinesPerChunk(const Imf::Header& header)
+{
+    int linesPerChunk = 1;
+
+    if (header.hasTileDescription()) {
+        linesPerChunk = header.tileDescription().ySize;
+    } else {
+        switch (header.compression()) {
+            case Imf::NO_COMPRESSION:
+            case Imf::RLE_COMPRESSION:
+            case Imf::ZIPS_COMPRESSION:
+                linesPerChunk = 1;
+                break;
+
+            case Imf::ZIP_COMPRESSION:
+            case Imf::PXR24_COMPRESSION:
+                linesPerChunk = 16;
+                break;
+
+            case Imf::DWAB_COMPRESSION:
+                linesPerChunk = 256;
+                break;
+
+            default:
+                linesPerChunk = 32;
+                break;
+        }
+    }
+
+    return linesPerChunk;
+}
+
+
+int FramebufferModel::getBandHeight(const Imf::Header& header)
+{
+    const int linesPerChunk = getLinesPerChunk(header);
+
+    // Give enough chunks to each band for OpenEXR to decode them in
+    // parallel, while keeping a band small enough for the image to fill
+    // in smoothly
+    const int minBandHeight
+      = std::max(64, linesPerChunk * ThreadPool::globalPool().getNumThreads());
+
+    return (minBandHeight + linesPerChunk - 1) / linesPerChunk
+           * linesPerChunk;
+}
+
+
+void FramebufferModel::loadTiledRegion(int, const QRect&) {}
+
+
+void FramebufferModel::loadDataRegion(int, const QRect&) {}
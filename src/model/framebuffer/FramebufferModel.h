@@ -32,11 +32,28 @@
 
 #pragma once
 
+#include "ChannelCache.h"
+
+#include <QFuture>
 #include <QFutureWatcher>
 #include <QImage>
+#include <QList>
 #include <QObject>
 #include <QRect>
+#include <QSize>
 #include <QVector>
+
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfHeader.h>
+#include <OpenEXR/ImfMultiPartInputFile.h>
+#include <OpenEXR/openexr.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
 #include <vector>
 
 class FramebufferModel: public QObject
@@ -44,6 +61,15 @@ class FramebufferModel: public QObject
     Q_OBJECT
 
   public:
+    // API used to decode the parts read entirely
+    enum DecodeBackend
+    {
+        // Imf::InputPart, decoding through the OpenEXR thread pool
+        Decode_OpenEXR,
+        // CoreDecoder, decoding the chunks concurrently on our thread pool
+        Decode_OpenEXRCore,
+    };
+
     FramebufferModel(QObject* parent = nullptr);
     virtual ~FramebufferModel();
 
@@ -51,6 +77,9 @@ class FramebufferModel: public QObject
 
     bool isImageLoaded() const { return m_isImageLoaded; }
 
+    // A load is still running in another thread
+    bool isLoading() const;
+
     int   width() const { return m_width; }
     int   height() const { return m_height; }
     float pixelAspectRatio() const { return m_pixelAspectRatio; }
@@ -58,30 +87,284 @@ class FramebufferModel: public QObject
     QRect getDisplayWindow() const;
     QRect getDataWindow() const;
 
+    // Mip level of the image, 0 being the full resolution
+    int getImageLevel() const { return m_imageLevel; }
+
+    // Region of the mip level covered by the image
+    QRect getImageRegion() const { return m_imageRegion; }
+
     virtual std::string getColorInfo(int x, int y) const = 0;
 
+    // When enabled, the framebuffer is read by bands of scanlines and each
+    // band is made available as soon as it is decoded
+    bool isProgressiveLoading() const { return m_progressiveLoading; }
+    void setProgressiveLoading(bool progressive)
+    {
+        m_progressiveLoading = progressive;
+    }
+
+    // Cache of the image the decoded channels are shared with, must be set
+    // before loading
+    void setChannelCache(ChannelCache* cache) { m_channelCache = cache; }
+
+    // OpenEXRCore context of the file, null when it cannot be read with
+    // OpenEXRCore e.g., for streams. Must be set before loading.
+    void setCoreContext(exr_const_context_t context)
+    {
+        m_coreContext = context;
+    }
+
+    static DecodeBackend getDecodeBackend() { return s_decodeBackend; }
+    static void setDecodeBackend(DecodeBackend backend)
+    {
+        s_decodeBackend = backend;
+    }
+
+    // Prints the time taken to decode each part, to compare the backends
+    static void setDecodeTimeLogged(bool logged) { s_logDecodeTime = logged; }
+
+    // Large images are first shown with a coarse proxy, which is replaced
+    // as the full resolution is decoded
+    static void setProxyShown(bool shown) { s_showProxy = shown; }
+
+    // Stops the running loads and conversions at their next band and waits
+    // for them to end. Must be called before the file is closed.
+    void cancelLoading();
+
+    // Height of the bands of scanlines read at once, the loads can be
+    // canceled between two bands
+    static int getBandHeight(const Imf::Header& header);
+
+    // Number of scanlines stored in a single chunk of the part
+    static int getLinesPerChunk(const Imf::Header& header);
+
+    int getPartId() const { return m_partID; }
+
+    // Reads the part from another version of its file, sharing its channels
+    // with the cache of this version. The decoded pixels are kept when the
+    // part did not change and was fully loaded, otherwise the part is loaded
+    // again.
+    void switchFile(
+      Imf::MultiPartInputFile& file,
+      ChannelCache*            cache,
+      exr_const_context_t      coreContext,
+      bool                     partChanged);
+
+    // Memory in bytes used by the displayed image
+    size_t getImageMemoryUsage() const;
+
+    // Adds the planes of decoded pixels, which may be shared with other
+    // models or with the prefetcher
+    virtual void getPlanes(std::set<const ChannelPlane*>& planes) const = 0;
+
+    // The pixels can be released to save memory: the model is hidden and
+    // fully loaded
+    bool canEvict() const;
+
+    // Releases the decoded pixels and keeps a small preview of the image,
+    // the pixels are decoded again once the model is visible
+    void evict();
+
+    bool isEvicted() const { return m_isEvicted; }
+
+  public slots:
+    // Part of the data window visible in the view (in full resolution
+    // pixels) and current zoom level
+    void setVisibleRegion(const QRect& region, double zoom);
+
+    // Reads only the scanline blocks or tiles covering a region of the data
+    // window (in full resolution pixels) and displays this region alone. A
+    // null region reads the whole data window again.
+    void loadRegion(const QRect& region);
+
+    // Whether the model is displayed, hidden models can be evicted
+    void setVisible(bool visible);
+
   signals:
     void imageChanged();
     void imageLoaded();
+    // Only the given region of the loaded image has been updated
+    void imageRegionChanged(const QRect& region);
     void exposureChanged(double exposure);
     void loadFailed(QString message);
+    // The last load or region read has ended
+    void loadFinished();
 
   protected:
-    std::vector<float> m_pixelBuffer;
-    QImage             m_image;
+    QImage m_image;
+
+    // Guards the image and the planes of the subclasses while a loading
+    // thread assigns them: the memory manager reads them on the GUI thread
+    mutable std::mutex m_memoryMutex;
 
     // Right now, the width and height are defined as Vec2i in OpenEXR
     // i.e. int type.
     int m_width, m_height;
 
     bool m_isImageLoaded;
+    bool m_progressiveLoading;
 
     double m_exposure;
 
     QFutureWatcher<void>* m_imageLoadingWatcher;
     QFutureWatcher<void>* m_imageEditingWatcher;
 
+    // Keeps track of a load running in another thread
+    void addLoading(const QFuture<void>& loading);
+
+    // Loads the part again from m_file
+    virtual void reload() = 0;
+
+    // Releases the planes of the framebuffer
+    virtual void releasePixels() = 0;
+
+    bool isLoadingCanceled() const { return m_loadingCanceled; }
+
+    // Stops the running loads at their next band as for a new region
+    // request and waits for them to end. Returns the id of the new request.
+    int abandonLoadings();
+
+    // The load started with this request id has been canceled or replaced
+    bool isLoadingAbandoned(int requestId) const
+    {
+        return m_loadingCanceled || m_tiledRequest != requestId;
+    }
+
     QRect m_dataWindow;
     QRect m_displayWindow;
     float m_pixelAspectRatio;
+
+    ChannelCache* m_channelCache;
+
+    exr_const_context_t m_coreContext;
+
+    // The channels of the part are decoded with CoreDecoder
+    bool isCoreDecoded(
+      int partId, const std::vector<std::string>& channels) const;
+
+    // Logs the time taken by a part to decode, if enabled
+    void logDecodeTime(int partId, bool coreDecoded, qint64 milliseconds) const;
+
+    // The part is large enough to show a proxy while it is decoded
+    bool isProxyShown() const;
+
+    // Fills the image with the preview stored in the header, if any.
+    // Returns false when the part has no preview.
+    bool showPreviewImage(const Imf::Header& header);
+
+    // Fills the image with one line every few chunks of the part, each line
+    // being repeated down to the next one. `readLine` decodes a line of the
+    // framebuffer and `convertLine` converts a line of the image. Returns
+    // false when the read is abandoned.
+    bool showSampledLines(
+      const Imf::Header&              header,
+      int                             requestId,
+      const std::function<void(int)>& readLine,
+      const std::function<void(int)>& convertLine);
+
+    // Position of the pixel (x, y) of the data window in the loaded
+    // framebuffer or -1 if this pixel is not loaded
+    int64_t getBufferIndex(int x, int y) const;
+
+    // Sets the framebuffer as covering the whole data window and creates the
+    // image to display it. The image is created at a coarser level when the
+    // full resolution one would be too large.
+    void initImage(QImage::Format format);
+
+    // Reads a region of the data window band by band. `insertSlices` fills
+    // the framebuffer of a band from the region of the data window it covers
+    // (whole lines for scanline parts, whole tiles for tiled ones) and
+    // `copyBand` is called once this band is decoded. Returns false when the
+    // read is abandoned.
+    bool readRegionBands(
+      const QRect&                                                region,
+      int                                                         requestId,
+      const std::function<void(Imf::FrameBuffer&, const QRect&)>& insertSlices,
+      const std::function<void(const QRect&)>&                    copyBand);
+
+    // Reads a region of the data window, aligned on the pixels of the level
+    // it is displayed at, and replaces the image and the framebuffer with it
+    virtual void loadDataRegion(int imageLevel, const QRect& region);
+
+    // Converts the image for display by tiles processed in parallel with
+    // `convertTile`. A canceled conversion stops at its next tile. The
+    // tiles covering `firstRegion` are converted and shown before the
+    // others. Returns false when canceled.
+    bool convertImageTiles(
+      const std::function<void(const QRect&)>& convertTile,
+      const QRect&                             firstRegion = QRect());
+
+    // Region of the image visible in the view, empty if unknown
+    QRect getVisibleImageRect() const;
+
+    // Position in the framebuffer of the first pixel of the image line y,
+    // and distance between two pixels of the image in the framebuffer
+    int getBufferLine(int y) const;
+    int getBufferStep() const { return 1 << (m_imageLevel - m_bufferLevel); }
+
+    // Tiled parts with mip levels are streamed: only the tiles visible in the
+    // view are read, from the level matching the zoom
+    bool initTiledStreaming(Imf::MultiPartInputFile& file, int partId);
+    bool isTiledStreaming() const { return !m_levelSizes.empty(); }
+
+    // Reads the tiles of the given level covering the region and replaces
+    // the image and the framebuffer with them
+    virtual void loadTiledRegion(int level, const QRect& region);
+
+    int   m_imageLevel;
+    QRect m_imageRegion;
+
+    // Level and region of the framebuffer, which may be finer than the image
+    int   m_bufferLevel;
+    QRect m_bufferRegion;
+
+    Imf::MultiPartInputFile* m_file;
+    int                      m_partID;
+
+    Imf::MultiPartInputFile* m_tiledFile;
+    int                      m_tiledPartID;
+    std::vector<QSize>       m_levelSizes;
+    QSize                    m_tileSize;
+
+    int   m_requestedLevel;
+    QRect m_requestedRegion;
+
+    // Incremented each time a new region is requested so outdated reads
+    // can be abandoned
+    std::atomic<int> m_tiledRequest;
+
+  private slots:
+    void onLoadFinished();
+
+  private:
+    // Coarsest mip level keeping an image of this size within the memory
+    // budget of the displayed image
+    static int getDisplayLevel(int width, int height);
+
+    // Size of the tiles the image is converted by
+    static const int s_conversionTileSize;
+
+    // Number of pixels of the preview kept by evicted models
+    static const int64_t s_previewPixels;
+
+    static std::atomic<DecodeBackend> s_decodeBackend;
+    static std::atomic<bool>          s_logDecodeTime;
+    static std::atomic<bool>          s_showProxy;
+
+    // Smallest number of pixels of a part shown with a proxy first
+    static const int64_t s_proxyMinPixels;
+
+    // Bounds of the number of lines sampled for a proxy
+    static const int s_proxyMinLines;
+    static const int s_proxyMaxLines;
+
+    QList<QFuture<void>> m_loadings;
+    std::atomic<bool>    m_loadingCanceled;
+
+    bool m_isVisible;
+    bool m_isEvicted;
+
+    // Last region of the data window visible in the view, in full
+    // resolution pixels
+    QRect m_visibleRegion;
 };
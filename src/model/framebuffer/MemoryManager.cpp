@@ -0,0 +1,154 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "MemoryManager.h"
+#include "ChannelPrefetcher.h"
+#include "FramebufferModel.h"
+
+MemoryManager::MemoryManager()
+  : m_budget(size_t(8) << 30)
+  , m_clock(0)
+{}
+
+
+MemoryManager& MemoryManager::global()
+{
+    static MemoryManager manager;
+    return manager;
+}
+
+
+void MemoryManager::setBudget(size_t bytes)
+{
+    m_budget = bytes;
+    update();
+}
+
+
+void MemoryManager::add(FramebufferModel* model)
+{
+    m_models[model] = ++m_clock;
+}
+
+
+void MemoryManager::remove(FramebufferModel* model)
+{
+    m_models.erase(model);
+}
+
+
+void MemoryManager::add(ChannelPrefetcher* prefetcher)
+{
+    m_prefetchers.insert(prefetcher);
+}
+
+
+void MemoryManager::remove(ChannelPrefetcher* prefetcher)
+{
+    m_prefetchers.erase(prefetcher);
+}
+
+
+void MemoryManager::touch(FramebufferModel* model)
+{
+    auto it = m_models.find(model);
+
+    if (it != m_models.end()) {
+        it->second = ++m_clock;
+    }
+}
+
+
+void MemoryManager::update()
+{
+    if (m_budget == 0) {
+        return;
+    }
+
+    size_t memoryUsed = getMemoryUsed();
+
+    // Prefetched planes no model displays are the cheapest to lose. The
+    // memory is computed again after each release: a plane still used
+    // elsewhere frees nothing.
+    for (ChannelPrefetcher* prefetcher : m_prefetchers) {
+        if (memoryUsed <= m_budget) {
+            return;
+        }
+
+        prefetcher->releasePlanes();
+        memoryUsed = getMemoryUsed();
+    }
+
+    while (memoryUsed > m_budget) {
+        FramebufferModel* oldest    = nullptr;
+        uint64_t          oldestUse = 0;
+
+        for (const auto& entry : m_models) {
+            if (
+              entry.first->canEvict()
+              && (!oldest || entry.second < oldestUse)) {
+                oldest    = entry.first;
+                oldestUse = entry.second;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        oldest->evict();
+        memoryUsed = getMemoryUsed();
+    }
+}
+
+
+size_t MemoryManager::getMemoryUsed() const
+{
+    size_t                        memoryUsed = 0;
+    std::set<const ChannelPlane*> planes;
+
+    for (const auto& entry : m_models) {
+        memoryUsed += entry.first->getImageMemoryUsage();
+        entry.first->getPlanes(planes);
+    }
+
+    for (ChannelPrefetcher* prefetcher : m_prefetchers) {
+        prefetcher->getPlanes(planes);
+    }
+
+    for (const ChannelPlane* plane : planes) {
+        memoryUsed += plane->sizeInBytes();
+    }
+
+    return memoryUsed;
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+
+class ChannelPrefetcher;
+class FramebufferModel;
+
+// Keeps the memory used by the framebuffer models and the prefetched
+// channels within a budget. A plane shared by several of them is counted
+// once. When the budget is exceeded, the prefetched planes are released
+// first, then the pixels of the hidden models used the longest time ago:
+// only a small preview of their image is kept. They are decoded again once
+// shown.
+//
+// Only used from the GUI thread.
+class MemoryManager
+{
+  public:
+    static MemoryManager& global();
+
+    // Memory in bytes the models can use, 0 for no limit
+    size_t getBudget() const { return m_budget; }
+    void   setBudget(size_t bytes);
+
+    void add(FramebufferModel* model);
+    void remove(FramebufferModel* model);
+
+    void add(ChannelPrefetcher* prefetcher);
+    void remove(ChannelPrefetcher* prefetcher);
+
+    // The model is displayed, it is released last
+    void touch(FramebufferModel* model);
+
+    // Releases models until the memory used fits in the budget
+    void update();
+
+  private:
+    MemoryManager();
+
+    // Memory in bytes used by the images and the distinct planes
+    size_t getMemoryUsed() const;
+
+    size_t m_budget;
+
+    // Models with the time they were last displayed
+    std::map<FramebufferModel*, uint64_t> m_models;
+    uint64_t                              m_clock;
+
+    std::set<ChannelPrefetcher*> m_prefetchers;
+};
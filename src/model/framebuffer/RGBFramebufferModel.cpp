@@ -31,49 +31,80 @@
  */
 
 #include "RGBFramebufferModel.h"
+#include "ChromaUpsampler.h"
+#include "CoreDecoder.h"
+#include "DeepFlattener.h"
 
 #include <util/ColorTransform.h>
+#include <util/ThreadPool.h>
 
+#include <QElapsedTimer>
 #include <QFuture>
+#include <QMetaObject>
 #include <QtConcurrent/QtConcurrent>
 
 #include <OpenEXR/ImfChromaticitiesAttribute.h>
+#include <OpenEXR/ImfCompression.h>
 #include <OpenEXR/ImfFrameBuffer.h>
 #include <OpenEXR/ImfHeader.h>
 #include <OpenEXR/ImfInputPart.h>
 #include <OpenEXR/ImfRgbaYca.h>
+#include <OpenEXR/ImfTileDescription.h>
+#include <OpenEXR/ImfTiledInputPart.h>
 
 #include <Imath/ImathBox.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 RGBFramebufferModel::RGBFramebufferModel(
   const std::string& parentLayerName, LayerType layerType, QObject* parent)
   : FramebufferModel(parent)
   , m_parentLayer(parentLayerName)
   , m_layerType(layerType)
   , m_exposure(0.)
+  , m_hasAlpha(false)
+  , m_convertColors(false)
+  , m_halfTableExposure(0.f)
 {}
 
-RGBFramebufferModel::~RGBFramebufferModel() {}
+RGBFramebufferModel::~RGBFramebufferModel()
+{
+    cancelLoading();
+}
 
 void RGBFramebufferModel::load(
   Imf::MultiPartInputFile& file, int partId, bool hasAlpha)
 {
+    m_file   = &file;
+    m_partID = partId;
+
+    // Id of the request this load belongs to, a region request replaces it
+    const int requestId = m_tiledRequest;
+
     QFuture<void> imageLoading = QtConcurrent::run([this,
                                                     &file,
                                                     partId,
-                                                    hasAlpha]() {
+                                                    hasAlpha,
+                                                    requestId]() {
+        // Canceled before it even started
+        if (isLoadingCanceled()) {
+            return;
+        }
+
         try {
-            Imf::InputPart part(file, partId);
+            const Imf::Header& header = file.header(partId);
 
-            Imath::Box2i datW = part.header().dataWindow();
+            Imath::Box2i datW = header.dataWindow();
             m_width           = datW.max.x - datW.min.x + 1;
             m_height          = datW.max.y - datW.min.y + 1;
 
-            m_pixelAspectRatio = part.header().pixelAspectRatio();
+            m_pixelAspectRatio = header.pixelAspectRatio();
 
             m_dataWindow = QRect(datW.min.x, datW.min.y, m_width, m_height);
 
-            Imath::Box2i dispW = part.header().displayWindow();
+            Imath::Box2i dispW = header.displayWindow();
 
             int dispW_width  = dispW.max.x - dispW.min.x + 1;
             int dispW_height = dispW.max.y - dispW.min.y + 1;
@@ -81,27 +112,10 @@ void RGBFramebufferModel::load(
             m_displayWindow
               = QRect(dispW.min.x, dispW.min.y, dispW_width, dispW_height);
 
-            // Check to avoid type overflow, width and height are 32bits int
-            // representing a 2 dimentional image. Can overflow the type when
-            // multiplied together.
-            // 0x1FFFFFFF is a save limit for 4 * 0x7FFFFFFF the max
-            // representable int since we need 4 channels.
-            // TODO: Use larger type when manipulating framebuffer
-            const uint64_t partial_size
-              = (uint64_t)m_width * (uint64_t)m_height;
-
-            if (partial_size > 0x1FFFFFFF) {
-                throw std::runtime_error(
-                  "The total image size is too large. May be supported in a "
-                  "future revision.");
-            }
-
-            m_pixelBuffer.resize(4 * m_width * m_height);
-
             // Check if there is specific chromaticities tied to the color
             // representation in this part.
             const Imf::ChromaticitiesAttribute* c
-              = part.header().findTypedAttribute<Imf::ChromaticitiesAttribute>(
+              = header.findTypedAttribute<Imf::ChromaticitiesAttribute>(
                 "chromaticities");
 
             Imf::Chromaticities chromaticities;
@@ -110,303 +124,959 @@ void RGBFramebufferModel::load(
                 chromaticities = c->value();
             }
 
-            // Check if there is alpha channel
-            if (hasAlpha) {
-                std::string      aLayer = m_parentLayer + "A";
-                Imf::FrameBuffer framebuffer;
+            // Handle custom chromaticities
+            Imath::M44f RGB_XYZ = Imf::RGBtoXYZ(chromaticities, 1.f);
+            Imath::M44f XYZ_RGB = Imf::XYZtoRGB(Imf::Chromaticities(), 1.f);
 
-                Imf::Slice aSlice = Imf::Slice::Make(
-                  Imf::PixelType::FLOAT,
-                  &m_pixelBuffer[3],
-                  datW,
-                  4 * sizeof(float),
-                  4 * m_width * sizeof(float));
+            // Deep parts are flattened while they are read
+            const bool isDeep = DeepFlattener::isDeep(header);
 
-                framebuffer.insert(aLayer, aSlice);
+            if (isDeep && m_layerType == Layer_YC) {
+                emit loadFailed(
+                  "Deep luminance/chroma parts are not supported");
+                return;
+            }
 
-                part.setFrameBuffer(framebuffer);
-                part.readPixels(datW.min.y, datW.max.y);
+            m_hasAlpha         = hasAlpha;
+            m_conversionMatrix = RGB_XYZ * XYZ_RGB;
+            m_convertColors    = m_layerType != Layer_Y
+                              && m_conversionMatrix != Imath::M44f();
+
+            // Mipmapped parts are read by tiles once the view tells which
+            // ones are visible. Chroma reconstruction needs full scanlines.
+            if (m_layerType != Layer_YC && initTiledStreaming(file, partId)) {
+                m_isImageLoaded = true;
+                emit imageLoaded();
+                return;
+            }
 
-            } else {
-                for (int y = 0; y < m_height; y++) {
-                    for (int x = 0; x < m_width; x++) {
-                        m_pixelBuffer[4 * (y * m_width + x) + 3] = 1.f;
-                    }
+            const Planes planes
+              = createPlanes(header.channels(), m_width, m_height);
+
+            {
+                std::lock_guard<std::mutex> lock(m_memoryMutex);
+                m_planes = planes;
+            }
+
+            // Channels already decoded for another view are shared, only the
+            // remaining ones are read from the file
+            const Planes toRead = shareCachedPlanes(partId);
+
+            initImage(QImage::Format_RGBA8888);
+
+            const bool readFile
+              = toRead[0] || toRead[1] || toRead[2] || toRead[3];
+
+            std::vector<std::string> channelsToRead;
+
+            for (int c = 0; c < 4; c++) {
+                const std::string channel = getChannelName(c);
+
+                if (toRead[c] && !channel.empty()) {
+                    channelsToRead.push_back(channel);
                 }
             }
 
-            switch (m_layerType) {
-                case Layer_RGB: {
-                    std::string rLayer = m_parentLayer + "R";
-                    std::string gLayer = m_parentLayer + "G";
-                    std::string bLayer = m_parentLayer + "B";
-
-                    Imf::FrameBuffer framebuffer;
-
-                    Imf::Slice rSlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &m_pixelBuffer[0],
-                      datW,
-                      4 * sizeof(float),
-                      4 * m_width * sizeof(float));
-
-                    Imf::Slice gSlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &m_pixelBuffer[1],
-                      datW,
-                      4 * sizeof(float),
-                      4 * m_width * sizeof(float));
-
-                    Imf::Slice bSlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &m_pixelBuffer[2],
-                      datW,
-                      4 * sizeof(float),
-                      4 * m_width * sizeof(float));
-
-                    framebuffer.insert(rLayer, rSlice);
-                    framebuffer.insert(gLayer, gSlice);
-                    framebuffer.insert(bLayer, bSlice);
-
-                    part.setFrameBuffer(framebuffer);
-                    part.readPixels(datW.min.y, datW.max.y);
-
-                    // Handle custom chromaticities
-                    Imath::M44f RGB_XYZ = Imf::RGBtoXYZ(chromaticities, 1.f);
-                    Imath::M44f XYZ_RGB
-                      = Imf::XYZtoRGB(Imf::Chromaticities(), 1.f);
-
-                    Imath::M44f conversionMatrix = RGB_XYZ * XYZ_RGB;
-
-                    #pragma omp parallel for
-                    for (int y = 0; y < m_height; y++) {
-                        for (int x = 0; x < m_width; x++) {
-                            const float r
-                              = m_pixelBuffer[4 * (y * m_width + x) + 0];
-                            const float g
-                              = m_pixelBuffer[4 * (y * m_width + x) + 1];
-                            const float b
-                              = m_pixelBuffer[4 * (y * m_width + x) + 2];
-
-                            Imath::V3f rgb(r, g, b);
-                            rgb *= conversionMatrix;
-
-                            m_pixelBuffer[4 * (y * m_width + x) + 0] = rgb.x;
-                            m_pixelBuffer[4 * (y * m_width + x) + 1] = rgb.y;
-                            m_pixelBuffer[4 * (y * m_width + x) + 2] = rgb.z;
-                        }
+            std::unique_ptr<Imf::InputPart> part;
+            std::unique_ptr<DeepFlattener>  flattener;
+            std::unique_ptr<CoreDecoder>    decoder;
+
+            if (isDeep) {
+                flattener.reset(new DeepFlattener(file, partId));
+
+                for (int c = 0; c < 4; c++) {
+                    const std::string channel = getChannelName(c);
+
+                    if (toRead[c] && !channel.empty()) {
+                        flattener->addChannel(channel, toRead[c].get());
                     }
-                } break;
-
-                case Layer_YC: {
-                    std::string yLayer  = m_parentLayer + "Y";
-                    std::string ryLayer = m_parentLayer + "RY";
-                    std::string byLayer = m_parentLayer + "BY";
-
-                    Imf::FrameBuffer framebuffer;
-
-                    std::vector<Imf::Rgba> buff1(m_width * m_height);
-                    std::vector<Imf::Rgba> buff2(m_width * m_height);
-
-                    std::vector<float> yBuffer(m_width * m_height);
-                    std::vector<float> ryBuffer(m_width / 2 * m_height / 2);
-                    std::vector<float> byBuffer(m_width / 2 * m_height / 2);
-
-                    Imf::Slice ySlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &yBuffer[0],
-                      datW,
-                      sizeof(float),
-                      m_width * sizeof(float));
-
-                    Imf::Slice rySlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &ryBuffer[0],
-                      datW,
-                      sizeof(float),
-                      m_width / 2 * sizeof(float),
-                      2,
-                      2);
-
-                    Imf::Slice bySlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &byBuffer[0],
-                      datW,
-                      sizeof(float),
-                      m_width / 2 * sizeof(float),
-                      2,
-                      2);
-
-                    framebuffer.insert(yLayer, ySlice);
-                    framebuffer.insert(ryLayer, rySlice);
-                    framebuffer.insert(byLayer, bySlice);
-
-                    part.setFrameBuffer(framebuffer);
-                    part.readPixels(datW.min.y, datW.max.y);
-
-                    // Filling missing values for chroma in the image
-                    // TODO: now, naive reconstruction.
-                    // Use later Imf::RgbaYca::reconstructChromaHoriz and
-                    // Imf::RgbaYca::reconstructChromaVert to reconstruct missing
-                    // pixels
-                    #pragma omp parallel for
-                    for (int y = 0; y < m_height; y++) {
-                        for (int x = 0; x < m_width; x++) {
-                            const float l = yBuffer[y * m_width + x];
-
-                            /*
-                            float ry = 0, by = 0;
-
-                            if (y % 2 == 0) {
-                                if (x % 2 == 0) {
-                                    ry = ryBuffer[y / 2 * m_width / 2 + x / 2];
-                                    by = byBuffer[y / 2 * m_width / 2 + x / 2];
-                                } else {
-                                    ry = .5 * (ryBuffer[y / 2 * m_width / 2 + x / 2] + ryBuffer[y / 2 * m_width / 2 + x / 2 + 1]);
-                                    by = .5 * (byBuffer[y / 2 * m_width / 2 + x / 2] + byBuffer[y / 2 * m_width / 2 + x / 2 + 1]);
-                                }
-                            } else {
-                                if (x % 2 == 0) {
-                                    ry = .5 * (ryBuffer[y / 2 * m_width / 2 + x / 2] + ryBuffer[(y / 2 + 1) * m_width / 2 + x / 2]);
-                                    by = .5 * (byBuffer[y / 2 * m_width / 2 + x / 2] + byBuffer[(y / 2 + 1) * m_width / 2 + x / 2]);
-                                } else {
-                                    ry = .25 * (ryBuffer[y / 2 * m_width / 2 + x / 2] + ryBuffer[(y / 2 + 1) * m_width / 2 + x / 2] + ryBuffer[y / 2 * m_width / 2 + x / 2 + 1] + ryBuffer[(y / 2 + 1) * m_width / 2 + x / 2 + 1]);
-                                    by = .25 * (byBuffer[y / 2 * m_width / 2 + x / 2] + byBuffer[(y / 2 + 1) * m_width / 2 + x / 2] + byBuffer[y / 2 * m_width / 2 + x / 2 + 1] + byBuffer[(y / 2 + 1) * m_width / 2 + x / 2 + 1]);
-                                }
-                            }
-                            */
-
-                            const float ry
-                              = ryBuffer[y / 2 * m_width / 2 + x / 2];
-                            const float by
-                              = byBuffer[y / 2 * m_width / 2 + x / 2];
-
-                            buff1[y * m_width + x].r = ry;
-                            buff1[y * m_width + x].g = l;
-                            buff1[y * m_width + x].b = by;
-                            // Do not forget the alpha values read earlier
-                            buff1[y * m_width + x].a
-                              = m_pixelBuffer[4 * (y * m_width + x) + 3];
-                        }
+                }
+            } else if (
+              m_layerType != Layer_YC
+              && isCoreDecoded(partId, channelsToRead)) {
+                decoder.reset(new CoreDecoder(m_coreContext, partId));
+
+                for (int c = 0; c < 4; c++) {
+                    const std::string channel = getChannelName(c);
+
+                    if (toRead[c] && !channel.empty()) {
+                        decoder->addChannel(channel, toRead[c].get());
                     }
+                }
+            } else {
+                part.reset(new Imf::InputPart(file, partId));
+            }
 
-                    Imath::V3f yw = Imf::RgbaYca::computeYw(chromaticities);
+            m_image.fill(Qt::transparent);
 
-                    // Proceed to the YCA -> RGBA conversion
-                    #pragma omp parallel for
-                    for (int y = 0; y < m_height; y++) {
-                        Imf::RgbaYca::YCAtoRGBA(
-                          yw,
-                          m_width,
-                          &buff1[y * m_width],
-                          &buff1[y * m_width]);
+            // In progressive mode, the image is shown as soon as its size is
+            // known and filled band after band while the file is decoded.
+            const bool progressive = m_progressiveLoading && readFile;
+            const int  bandHeight  = getBandHeight(header);
+
+            if (progressive) {
+                m_isImageLoaded = true;
+                emit imageLoaded();
+            }
+
+            // Large images are first shown with their preview or with a
+            // few sampled lines. The preview shows the RGB of the part, so
+            // it is not used for its other layers.
+            if (
+              progressive && m_layerType != Layer_YC && isProxyShown()
+              && !(m_parentLayer.empty() && showPreviewImage(header))) {
+                const bool shown = showSampledLines(
+                  header,
+                  requestId,
+                  [&](int y) {
+                      const int line = datW.min.y + y;
+
+                      if (flattener) {
+                          flattener->readLines(line, line);
+                      } else if (decoder) {
+                          decoder->readLines(line, line);
+                      } else {
+                          readBand(*part, toRead, line, line);
+                      }
+                  },
+                  [&](int y) {
+                      updateImageLines(y, y + 1, std::exp2(m_exposure));
+                  });
+
+                if (!shown) {
+                    return;
+                }
+            }
+
+            // Only the decoding is timed, not the display of the bands
+            qint64 decodeTime = 0;
+
+            if (m_layerType == Layer_YC) {
+                // Chroma is reconstructed and converted band after band
+                if (!loadYC(
+                      *part,
+                      chromaticities,
+                      toRead[3] != nullptr,
+                      progressive,
+                      requestId)) {
+                    return;
+                }
+            } else {
+                for (int yStart = datW.min.y; readFile && yStart <= datW.max.y;
+                     yStart += bandHeight) {
+                    const int yEnd
+                      = std::min(yStart + bandHeight - 1, datW.max.y);
+
+                    if (isLoadingAbandoned(requestId)) {
+                        return;
                     }
 
-                    // Fix over saturated pixels
-                    #pragma omp parallel for
-                    for (int y = 0; y < m_height; y++) {
-                        const Imf::Rgba* scanlines[3];
-
-                        if (y == 0) {
-                            scanlines[0] = &buff1[(y + 1) * m_width];
-                        } else {
-                            scanlines[0] = &buff1[(y - 1) * m_width];
-                        }
-
-                        scanlines[1] = &buff1[y * m_width];
-
-                        if (y == m_height - 1) {
-                            scanlines[2] = &buff1[(y - 1) * m_width];
-                        } else {
-                            scanlines[2] = &buff1[(y + 1) * m_width];
-                        }
-
-                        Imf::RgbaYca::fixSaturation(
-                          yw,
-                          m_width,
-                          scanlines,
-                          &buff2[y * m_width]);
+                    QElapsedTimer decodeTimer;
+                    decodeTimer.start();
+
+                    if (flattener) {
+                        flattener->readLines(yStart, yEnd);
+                    } else if (decoder) {
+                        decoder->readLines(yStart, yEnd);
+                    } else {
+                        readBand(*part, toRead, yStart, yEnd);
+                    }
+
+                    decodeTime += decodeTimer.nsecsElapsed();
+
+                    if (progressive) {
+                        showLoadedLines(yStart - datW.min.y, yEnd - datW.min.y);
                     }
+                }
+            }
 
-                    // Handle custom chromaticities
-                    Imath::M44f RGB_XYZ = Imf::RGBtoXYZ(chromaticities, 1.f);
-                    Imath::M44f XYZ_RGB
-                      = Imf::XYZtoRGB(Imf::Chromaticities(), 1.f);
+            if (isLoadingAbandoned(requestId)) {
+                return;
+            }
 
-                    Imath::M44f conversionMatrix = RGB_XYZ * XYZ_RGB;
+            // Luminance and chroma are converted while they are read, and
+            // only OpenEXR reads them
+            if (readFile && m_layerType != Layer_YC) {
+                logDecodeTime(partId, decoder != nullptr, decodeTime / 1000000);
+            }
 
-                    #pragma omp parallel for
-                    for (int y = 0; y < m_height; y++) {
-                        for (int x = 0; x < m_width; x++) {
-                            Imath::V3f rgb(
-                              buff2[y * m_width + x].r,
-                              buff2[y * m_width + x].g,
-                              buff2[y * m_width + x].b);
+            cachePlanes(partId, toRead);
 
-                            rgb = rgb * conversionMatrix;
+            if (!progressive) {
+                m_isImageLoaded = true;
+                emit imageLoaded();
 
-                            m_pixelBuffer[4 * (y * m_width + x) + 0] = rgb.x;
-                            m_pixelBuffer[4 * (y * m_width + x) + 1] = rgb.y;
-                            m_pixelBuffer[4 * (y * m_width + x) + 2] = rgb.z;
-                        }
-                    }
+                updateImage();
+            }
+        } catch (std::exception& e) {
+            emit loadFailed(e.what());
+            return;
+        }
+    });
+
+    addLoading(imageLoading);
+}
+
+
+RGBFramebufferModel::Planes RGBFramebufferModel::createPlanes(
+  const Imf::ChannelList& channels, int width, int height) const
+{
+    Planes planes;
+
+    switch (m_layerType) {
+        case Layer_RGB: {
+            const char* suffixes[3] = {"R", "G", "B"};
+
+            for (int c = 0; c < 3; c++) {
+                const Imf::Channel* channel
+                  = channels.findChannel(m_parentLayer + suffixes[c]);
+
+                planes[c] = std::make_shared<ChannelPlane>(
+                  channel ? channel->type : Imf::FLOAT,
+                  width,
+                  height);
+            }
+        } break;
+
+        case Layer_Y: {
+            const Imf::Channel* channel = channels.findChannel(m_parentLayer);
+
+            planes[0] = std::make_shared<ChannelPlane>(
+              channel ? channel->type : Imf::FLOAT,
+              width,
+              height);
+
+            planes[1] = planes[0];
+            planes[2] = planes[0];
+        } break;
+
+        case Layer_YC:
+            // The YCA to RGBA conversion is done on half values
+            for (int c = 0; c < 3; c++) {
+                planes[c]
+                  = std::make_shared<ChannelPlane>(Imf::HALF, width, height);
+            }
+            break;
+    }
+
+    if (m_hasAlpha) {
+        const Imf::Channel* channel = channels.findChannel(m_parentLayer + "A");
+
+        planes[3] = std::make_shared<ChannelPlane>(
+          channel ? channel->type : Imf::FLOAT,
+          width,
+          height);
+    }
+
+    return planes;
+}
+
+
+void RGBFramebufferModel::insertColorSlices(
+  Imf::FrameBuffer& framebuffer,
+  const Planes&     planes,
+  const Imath::V2i& origin) const
+{
+    switch (m_layerType) {
+        case Layer_RGB: {
+            const char* suffixes[3] = {"R", "G", "B"};
+
+            for (int c = 0; c < 3; c++) {
+                if (planes[c]) {
+                    framebuffer.insert(
+                      m_parentLayer + suffixes[c],
+                      planes[c]->slice(origin));
                 }
+            }
+        } break;
+
+        case Layer_Y:
+            if (planes[0]) {
+                framebuffer.insert(m_parentLayer, planes[0]->slice(origin));
+            }
+            break;
+
+        case Layer_YC:
+            // Handled by loadYC()
+            break;
+    }
+}
+
+
+std::string RGBFramebufferModel::getChannelName(int plane) const
+{
+    if (plane == 3) {
+        return m_parentLayer + "A";
+    }
+
+    switch (m_layerType) {
+        case Layer_RGB: {
+            const char* suffixes[3] = {"R", "G", "B"};
+            return m_parentLayer + suffixes[plane];
+        }
+
+        case Layer_Y:
+            return plane == 0 ? m_parentLayer : std::string();
+
+        case Layer_YC:
+            // Reconstructed from the luminance and chroma channels
+            break;
+    }
+
+    return std::string();
+}
+
+
+RGBFramebufferModel::Planes RGBFramebufferModel::shareCachedPlanes(int partId)
+{
+    Planes toRead = m_planes;
+
+    if (!m_channelCache) {
+        return toRead;
+    }
+
+    for (int c = 0; c < 4; c++) {
+        const std::string channel = getChannelName(c);
+
+        if (!m_planes[c] || channel.empty()) {
+            continue;
+        }
+
+        std::shared_ptr<ChannelPlane> cached
+          = m_channelCache->find(partId, channel);
+
+        if (cached) {
+            std::lock_guard<std::mutex> lock(m_memoryMutex);
+
+            // For Y layers, the G and B planes are the same as R
+            for (int i = 0; i < 4; i++) {
+                if (toRead[i] == m_planes[c] && i != c) {
+                    toRead[i]   = nullptr;
+                    m_planes[i] = cached;
+                }
+            }
+
+            toRead[c]   = nullptr;
+            m_planes[c] = cached;
+        }
+    }
+
+    return toRead;
+}
+
+
+void RGBFramebufferModel::cachePlanes(int partId, const Planes& planes)
+{
+    if (!m_channelCache) {
+        return;
+    }
+
+    for (int c = 0; c < 4; c++) {
+        const std::string channel = getChannelName(c);
+
+        if (planes[c] && !channel.empty()) {
+            m_channelCache->insert(partId, channel, planes[c]);
+        }
+    }
+}
+
+
+void RGBFramebufferModel::readBand(
+  Imf::InputPart& part, const Planes& planes, int yStart, int yEnd)
+{
+    const Imath::Box2i datW = part.header().dataWindow();
+
+    // All the channels are read in a single pass so each chunk of the file
+    // is decompressed only once
+    Imf::FrameBuffer framebuffer;
+
+    insertColorSlices(framebuffer, planes, datW.min);
+
+    if (planes[3]) {
+        framebuffer.insert(m_parentLayer + "A", planes[3]->slice(datW.min));
+    }
+
+    part.setFrameBuffer(framebuffer);
+    part.readPixels(yStart, yEnd);
+}
+
+
+bool RGBFramebufferModel::loadYC(
+  Imf::InputPart&            part,
+  const Imf::Chromaticities& chromaticities,
+  bool                       readAlpha,
+  bool                       progressive,
+  int                        requestId)
+{
+    const Imath::Box2i datW = part.header().dataWindow();
+
+    const std::string yLayer  = m_parentLayer + "Y";
+    const std::string ryLayer = m_parentLayer + "RY";
+    const std::string byLayer = m_parentLayer + "BY";
+
+    // Both chroma channels share the same sampling
+    const Imf::Channel* chromaChannel
+      = part.header().channels().findChannel(ryLayer);
+
+    const ChromaUpsampler upsampler(
+      m_width,
+      chromaChannel ? chromaChannel->xSampling : 1,
+      chromaChannel ? chromaChannel->ySampling : 1);
+
+    const int xSampling   = upsampler.xSampling();
+    const int ySampling   = upsampler.ySampling();
+    const int sampleWidth = upsampler.sampleWidth();
+    const int lastSample  = (m_height - 1) / ySampling;
+
+    // Bands start on chroma lines. The lines following the last chroma line
+    // of a band need the first chroma line of the next band: they are
+    // converted with the next band.
+    const int bandHeight = std::max(
+      2 * ySampling,
+      (getBandHeight(part.header()) + ySampling - 1) / ySampling * ySampling);
+
+    // Luminance and chroma of the band, preceded by what the previous band
+    // left to convert
+    std::vector<float> yBuffer((size_t)(bandHeight + ySampling) * m_width);
+    std::vector<float> ryBuffer(
+      (size_t)(bandHeight / ySampling + 1) * sampleWidth);
+    std::vector<float> byBuffer(
+      (size_t)(bandHeight / ySampling + 1) * sampleWidth);
+
+    // Lines converted to RGBA, preceded by the last two lines converted with
+    // the previous band: fixing the saturation of a line needs its
+    // neighbours
+    std::vector<Imf::Rgba> window(
+      (size_t)(bandHeight + ySampling + 2) * m_width);
+
+    const Imath::V3f yw = Imf::RgbaYca::computeYw(chromaticities);
+
+    half* r = m_planes[0]->halfData();
+    half* g = m_planes[1]->halfData();
+    half* b = m_planes[2]->halfData();
+
+    for (int yStart = 0; yStart < m_height; yStart += bandHeight) {
+        // The GUI thread may be waiting for the abandoned load
+        if (isLoadingAbandoned(requestId)) {
+            return false;
+        }
+
+        const int yEnd   = std::min(yStart + bandHeight, m_height);
+        const int nLines = yEnd - yStart;
+
+        // First line of the luminance and first chroma line in the buffers
+        const int yBufferStart      = yStart - ySampling;
+        const int chromaBufferStart = yStart / ySampling - 1;
+
+        const Imath::V2i origin(datW.min.x, datW.min.y + yStart);
+
+        Imf::FrameBuffer framebuffer;
+
+        framebuffer.insert(
+          yLayer,
+          Imf::Slice::Make(
+            Imf::PixelType::FLOAT,
+            &yBuffer[(size_t)ySampling * m_width],
+            origin,
+            m_width,
+            nLines,
+            sizeof(float),
+            m_width * sizeof(float)));
+
+        framebuffer.insert(
+          ryLayer,
+          Imf::Slice::Make(
+            Imf::PixelType::FLOAT,
+            &ryBuffer[sampleWidth],
+            origin,
+            m_width,
+            nLines,
+            sizeof(float),
+            sampleWidth * sizeof(float),
+            xSampling,
+            ySampling));
+
+        framebuffer.insert(
+          byLayer,
+          Imf::Slice::Make(
+            Imf::PixelType::FLOAT,
+            &byBuffer[sampleWidth],
+            origin,
+            m_width,
+            nLines,
+            sizeof(float),
+            sampleWidth * sizeof(float),
+            xSampling,
+            ySampling));
+
+        if (readAlpha) {
+            framebuffer.insert(
+              m_parentLayer + "A",
+              m_planes[3]->slice(datW.min));
+        }
+
+        part.setFrameBuffer(framebuffer);
+        part.readPixels(origin.y, datW.min.y + yEnd - 1);
+
+        // Lines having both their chroma lines read
+        const int convertStart = std::max(0, yStart - ySampling);
+        const int convertEnd   = yEnd == m_height ? m_height : yEnd - ySampling;
+
+        // Line y is stored in the line y - windowStart of the window
+        const int windowStart = convertStart - 2;
+
+        ThreadPool::globalPool().parallelFor(
+          convertStart,
+          convertEnd,
+          [&](int64_t y0, int64_t y1) {
+              std::vector<float> samples(sampleWidth + 1);
+              std::vector<float> ry(m_width), by(m_width);
+
+              for (int y = y0; y < y1; y++) {
+                  const int    s0 = y / ySampling;
+                  const int    s1 = std::min(s0 + 1, lastSample);
+                  const size_t c0 = (size_t)(s0 - chromaBufferStart);
+                  const size_t c1 = (size_t)(s1 - chromaBufferStart);
+
+                  upsampler.upsampleLine(
+                    y,
+                    &ryBuffer[c0 * sampleWidth],
+                    &ryBuffer[c1 * sampleWidth],
+                    samples.data(),
+                    ry.data());
+
+                  upsampler.upsampleLine(
+                    y,
+                    &byBuffer[c0 * sampleWidth],
+                    &byBuffer[c1 * sampleWidth],
+                    samples.data(),
+                    by.data());
+
+                  const float* l
+                    = &yBuffer[(size_t)(y - yBufferStart) * m_width];
+
+                  Imf::Rgba* line
+                    = &window[(size_t)(y - windowStart) * m_width];
+
+                  for (int x = 0; x < m_width; x++) {
+                      line[x].r = ry[x];
+                      line[x].g = l[x];
+                      line[x].b = by[x];
+                      line[x].a = m_hasAlpha ? m_planes[3]->value(x, y) : 1.f;
+                  }
+
+                  // Proceed to the YCA -> RGBA conversion
+                  Imf::RgbaYca::YCAtoRGBA(yw, m_width, line, line);
+              }
+          },
+          16);
+
+        // Fix over saturated pixels of the lines having both neighbours
+        // converted, the last converted line waits for the next band
+        const int fixStart = std::max(0, convertStart - 1);
+        const int fixEnd = convertEnd == m_height ? m_height : convertEnd - 1;
+
+        ThreadPool::globalPool().parallelFor(
+          fixStart,
+          fixEnd,
+          [&](int64_t y0, int64_t y1) {
+              std::vector<Imf::Rgba> fixed(m_width);
+
+              for (int y = y0; y < y1; y++) {
+                  const int prev
+                    = y > 0 ? y - 1 : std::min(1, m_height - 1);
+                  const int next
+                    = y < m_height - 1 ? y + 1 : std::max(0, y - 1);
+
+                  const Imf::Rgba* scanlines[3] = {
+                    &window[(size_t)(prev - windowStart) * m_width],
+                    &window[(size_t)(y - windowStart) * m_width],
+                    &window[(size_t)(next - windowStart) * m_width]};
+
+                  Imf::RgbaYca::fixSaturation(
+                    yw,
+                    m_width,
+                    scanlines,
+                    fixed.data());
+
+                  const size_t offset = (size_t)y * m_width;
+
+                  for (int x = 0; x < m_width; x++) {
+                      r[offset + x] = fixed[x].r;
+                      g[offset + x] = fixed[x].g;
+                      b[offset + x] = fixed[x].b;
+                  }
+              }
+          },
+          16);
+
+        if (progressive) {
+            showLoadedLines(fixStart, fixEnd - 1);
+        }
+
+        // Move what the next band needs to the front of the buffers
+        std::copy(
+          yBuffer.begin() + (size_t)nLines * m_width,
+          yBuffer.begin() + (size_t)(nLines + ySampling) * m_width,
+          yBuffer.begin());
 
-                break;
+        const size_t lastChroma
+          = (size_t)((yEnd - 1) / ySampling - chromaBufferStart);
 
-                case Layer_Y: {
-                    std::string yLayer = m_parentLayer;
+        std::copy(
+          ryBuffer.begin() + lastChroma * sampleWidth,
+          ryBuffer.begin() + (lastChroma + 1) * sampleWidth,
+          ryBuffer.begin());
 
-                    Imf::FrameBuffer framebuffer;
+        std::copy(
+          byBuffer.begin() + lastChroma * sampleWidth,
+          byBuffer.begin() + (lastChroma + 1) * sampleWidth,
+          byBuffer.begin());
 
-                    Imf::Slice ySlice = Imf::Slice::Make(
-                      Imf::PixelType::FLOAT,
-                      &m_pixelBuffer[0],
-                      datW,
-                      4 * sizeof(float),
-                      4 * m_width * sizeof(float));
+        const size_t nConverted = (size_t)(convertEnd - convertStart);
 
-                    framebuffer.insert(yLayer, ySlice);
+        std::copy(
+          window.begin() + nConverted * m_width,
+          window.begin() + (nConverted + 2) * m_width,
+          window.begin());
+    }
+
+    return true;
+}
+
+
+void RGBFramebufferModel::loadTiledRegion(int level, const QRect& region)
+{
+    const int requestId = ++m_tiledRequest;
+
+    const Planes planes = createPlanes(
+      m_tiledFile->header(m_tiledPartID).channels(),
+      region.width(),
+      region.height());
+
+    // Keep the pixels already loaded at this level, only the missing tiles
+    // are read from the file
+    QRect loadedRegion;
+
+    if (m_planes[0] && level == m_bufferLevel) {
+        loadedRegion = m_bufferRegion.intersected(region);
+
+        for (int c = 0; c < 4; c++) {
+            // Y layers share the same plane for R, G and B
+            if (planes[c] && (c == 0 || planes[c] != planes[0])) {
+                planes[c]->copy(
+                  *m_planes[c],
+                  loadedRegion.x() - m_bufferRegion.x(),
+                  loadedRegion.y() - m_bufferRegion.y(),
+                  loadedRegion.x() - region.x(),
+                  loadedRegion.y() - region.y(),
+                  loadedRegion.width(),
+                  loadedRegion.height());
+            }
+        }
+    }
+
+    QFuture<void> imageLoading = QtConcurrent::run([this,
+                                                    level,
+                                                    region,
+                                                    loadedRegion,
+                                                    planes,
+                                                    requestId]() {
+        try {
+            Imf::TiledInputPart part(*m_tiledFile, m_tiledPartID);
+
+            const Imath::Box2i levelDatW = part.dataWindowForLevel(level, level);
+
+            // Position of the planes in the level data window
+            const Imath::V2i origin(
+              levelDatW.min.x + region.left(),
+              levelDatW.min.y + region.top());
+
+            Imf::FrameBuffer framebuffer;
+
+            insertColorSlices(framebuffer, planes, origin);
+
+            if (m_hasAlpha) {
+                framebuffer.insert(
+                  m_parentLayer + "A",
+                  planes[3]->slice(origin));
+            }
 
-                    part.setFrameBuffer(framebuffer);
-                    part.readPixels(datW.min.y, datW.max.y);
+            part.setFrameBuffer(framebuffer);
 
-                    #pragma omp parallel for
-                    for (int i = 0; i < m_height * m_width; i++) {
-                        m_pixelBuffer[4 * i + 1] = m_pixelBuffer[4 * i + 0];
-                        m_pixelBuffer[4 * i + 2] = m_pixelBuffer[4 * i + 0];
-                        m_pixelBuffer[4 * i + 3] = 1.f;
+            const int tileW = part.tileXSize();
+            const int tileH = part.tileYSize();
+
+            const int tx0 = region.left() / tileW;
+            const int tx1 = region.right() / tileW;
+            const int ty0 = region.top() / tileH;
+            const int ty1 = region.bottom() / tileH;
+
+            for (int ty = ty0; ty <= ty1; ty++) {
+                // A newer region was requested in the meantime
+                if (m_tiledRequest != requestId) {
+                    return;
+                }
+
+                int tx = tx0;
+
+                while (tx <= tx1) {
+                    const QRect tile
+                      = QRect(tx * tileW, ty * tileH, tileW, tileH)
+                          .intersected(region);
+
+                    if (loadedRegion.contains(tile)) {
+                        tx++;
+                        continue;
+                    }
+
+                    // Read consecutive missing tiles at once
+                    int txEnd = tx;
+
+                    while (txEnd + 1 <= tx1
+                           && !loadedRegion.contains(
+                             QRect((txEnd + 1) * tileW, ty * tileH, tileW, tileH)
+                               .intersected(region))) {
+                        txEnd++;
                     }
-                } break;
+
+                    part.readTiles(tx, txEnd, ty, ty, level, level);
+
+                    tx = txEnd + 1;
+                }
             }
 
-            m_image = QImage(m_width, m_height, QImage::Format_RGBA8888);
-            m_isImageLoaded = true;
+            // The planes are swapped in the thread owning the model so that
+            // pixel queries never see a partially replaced framebuffer
+            QMetaObject::invokeMethod(
+              this,
+              [this, level, region, planes, requestId]() {
+                  if (m_tiledRequest != requestId) {
+                      return;
+                  }
+
+                  if (m_imageEditingWatcher->isRunning()) {
+                      m_imageEditingWatcher->cancel();
+                      m_imageEditingWatcher->waitForFinished();
+                  }
+
+                  m_planes = planes;
+                  m_image  = QImage(
+                    region.width(),
+                    region.height(),
+                    QImage::Format_RGBA8888);
+
+                  m_imageLevel   = level;
+                  m_imageRegion  = region;
+                  m_bufferLevel  = level;
+                  m_bufferRegion = region;
+
+                  updateImage();
+              },
+              Qt::QueuedConnection);
+        } catch (std::exception& e) {
+            emit loadFailed(e.what());
+            return;
+        }
+    });
 
-            emit imageLoaded();
+    addLoading(imageLoading);
+}
 
-            updateImage();
+
+void RGBFramebufferModel::loadDataRegion(int imageLevel, const QRect& region)
+{
+    const Imf::Header& header = m_file->header(m_partID);
+
+    // Chroma reconstruction and deep flattening work on whole parts
+    if (m_layerType == Layer_YC || DeepFlattener::isDeep(header)) {
+        return;
+    }
+
+    const int requestId = abandonLoadings();
+
+    const Planes planes
+      = createPlanes(header.channels(), region.width(), region.height());
+
+    QFuture<void> imageLoading = QtConcurrent::run([this,
+                                                    imageLevel,
+                                                    region,
+                                                    planes,
+                                                    requestId]() {
+        try {
+            const Imath::Box2i datW = m_file->header(m_partID).dataWindow();
+
+            // Bands are decoded in their own planes, only the pixels in the
+            // region are kept
+            Planes bandPlanes;
+
+            auto insertSlices = [&](Imf::FrameBuffer& framebuffer,
+                                    const QRect&      band) {
+                bandPlanes = createPlanes(
+                  m_file->header(m_partID).channels(),
+                  band.width(),
+                  band.height());
+
+                const Imath::V2i origin(
+                  datW.min.x + band.left(),
+                  datW.min.y + band.top());
+
+                insertColorSlices(framebuffer, bandPlanes, origin);
+
+                if (m_hasAlpha) {
+                    framebuffer.insert(
+                      m_parentLayer + "A",
+                      bandPlanes[3]->slice(origin));
+                }
+            };
+
+            auto copyBand = [&](const QRect& band) {
+                const QRect copied = band.intersected(region);
+
+                for (int c = 0; c < 4; c++) {
+                    // Y layers share the same plane for R, G and B
+                    if (planes[c] && (c == 0 || planes[c] != planes[0])) {
+                        planes[c]->copy(
+                          *bandPlanes[c],
+                          copied.x() - band.x(),
+                          copied.y() - band.y(),
+                          copied.x() - region.x(),
+                          copied.y() - region.y(),
+                          copied.width(),
+                          copied.height());
+                    }
+                }
+            };
+
+            if (!readRegionBands(region, requestId, insertSlices, copyBand)) {
+                return;
+            }
+
+            // The planes are swapped in the thread owning the model so that
+            // pixel queries never see a partially replaced framebuffer
+            QMetaObject::invokeMethod(
+              this,
+              [this, imageLevel, region, planes, requestId]() {
+                  if (m_tiledRequest != requestId) {
+                      return;
+                  }
+
+                  if (m_imageEditingWatcher->isRunning()) {
+                      m_imageEditingWatcher->cancel();
+                      m_imageEditingWatcher->waitForFinished();
+                  }
+
+                  m_planes = planes;
+
+                  m_imageLevel  = imageLevel;
+                  m_imageRegion = QRect(
+                    region.x() >> imageLevel,
+                    region.y() >> imageLevel,
+                    region.width() >> imageLevel,
+                    region.height() >> imageLevel);
+
+                  m_bufferLevel  = 0;
+                  m_bufferRegion = region;
+
+                  m_image = QImage(
+                    m_imageRegion.width(),
+                    m_imageRegion.height(),
+                    QImage::Format_RGBA8888);
+
+                  m_isImageLoaded = true;
+
+                  updateImage();
+              },
+              Qt::QueuedConnection);
         } catch (std::exception& e) {
             emit loadFailed(e.what());
             return;
         }
     });
 
-    m_imageLoadingWatcher->setFuture(imageLoading);
+    addLoading(imageLoading);
+}
+
+
+std::shared_ptr<const std::vector<unsigned char>>
+RGBFramebufferModel::getHalfTable(float exposureMul)
+{
+    // Half planes without color conversion are displayed with a single
+    // lookup per component instead of a power per pixel
+    if (
+      m_convertColors || m_planes[0]->type() != Imf::HALF
+      || m_planes[1]->type() != Imf::HALF
+      || m_planes[2]->type() != Imf::HALF) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_halfTableMutex);
+
+    if (!m_halfTable || m_halfTableExposure != exposureMul) {
+        std::shared_ptr<std::vector<unsigned char>> table
+          = std::make_shared<std::vector<unsigned char>>(65536);
+
+        ColorTransform::fill_sRGB_255_half_table(exposureMul, table->data());
+
+        m_halfTable         = table;
+        m_halfTableExposure = exposureMul;
+    }
+
+    return m_halfTable;
+}
+
+
+Imath::V3f RGBFramebufferModel::getRGB(int64_t index) const
+{
+    Imath::V3f rgb(
+      m_planes[0]->value(index),
+      m_planes[1]->value(index),
+      m_planes[2]->value(index));
+
+    if (m_convertColors) {
+        rgb *= m_conversionMatrix;
+    }
+
+    return rgb;
+}
+
+
+float RGBFramebufferModel::getAlpha(int64_t index) const
+{
+    return m_planes[3] ? m_planes[3]->value(index) : 1.f;
+}
+
+
+void RGBFramebufferModel::getPlanes(
+  std::set<const ChannelPlane*>& planes) const
+{
+    std::lock_guard<std::mutex> lock(m_memoryMutex);
+
+    // Y layers share the same plane for R, G and B
+    for (int c = 0; c < 4; c++) {
+        if (m_planes[c]) {
+            planes.insert(m_planes[c].get());
+        }
+    }
 }
 
+
 std::string RGBFramebufferModel::getColorInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return "";
     }
 
+    const Imath::V3f rgb = getRGB(i);
+
     std::stringstream ss;
     ss << "x: " << x << " y: " << y << " | "
-       << " R: " << m_pixelBuffer[4 * (y * width() + x) + 0]
-       << " G: " << m_pixelBuffer[4 * (y * width() + x) + 1]
-       << " B: " << m_pixelBuffer[4 * (y * width() + x) + 2]
-       << " A: " << m_pixelBuffer[4 * (y * width() + x) + 3];
+       << " R: " << rgb.x
+       << " G: " << rgb.y
+       << " B: " << rgb.z
+       << " A: " << getAlpha(i);
 
     return ss.str();
 }
@@ -414,54 +1084,63 @@ std::string RGBFramebufferModel::getColorInfo(int x, int y) const
 
 float RGBFramebufferModel::getRedInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return 0;
     }
 
-    return m_pixelBuffer[4 * (y * width() + x) + 0];
+    return getRGB(i).x;
 }
 
 
 float RGBFramebufferModel::getGreenInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return 0;
     }
 
-    return m_pixelBuffer[4 * (y * width() + x) + 1];
+    return getRGB(i).y;
 }
 
 
 float RGBFramebufferModel::getBlueInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return 0;
     }
 
-    return m_pixelBuffer[4 * (y * width() + x) + 2];
+    return getRGB(i).z;
 }
 
+
 float RGBFramebufferModel::getAlphaInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return 0;
     }
 
-    return m_pixelBuffer[4 * (y * width() + x) + 3];
+    return getAlpha(i);
 }
 
-
 void RGBFramebufferModel::setExposure(double value)
 {
     if (m_exposure == value) return;
 
     m_exposure = value;
-    updateImage();
+    updateImage(true);
 }
 
-void RGBFramebufferModel::updateImage()
+void RGBFramebufferModel::updateImage(bool visibleFirst)
 {
-    if (!m_isImageLoaded) {
+    // The planes are released while the model is evicted
+    if (!m_isImageLoaded || !m_planes[0]) {
         return;
     }
 
@@ -475,38 +1154,153 @@ void RGBFramebufferModel::updateImage()
 
     float m_exposure_mul = std::exp2(m_exposure);
 
+    const QRect firstRegion = visibleFirst ? getVisibleImageRect() : QRect();
+
     QFuture<void> imageConverting = QtConcurrent::run([=]() {
-        for (int y = 0; y < m_image.height(); y++) {
-            unsigned char* line = m_image.scanLine(y);
-
-            #pragma omp parallel for
-            for (int x = 0; x < m_image.width(); x++) {
-                const float r = ColorTransform::to_sRGB(
-                  m_exposure_mul * m_pixelBuffer[4 * (y * m_width + x) + 0]);
-                const float g = ColorTransform::to_sRGB(
-                  m_exposure_mul * m_pixelBuffer[4 * (y * m_width + x) + 1]);
-                const float b = ColorTransform::to_sRGB(
-                  m_exposure_mul * m_pixelBuffer[4 * (y * m_width + x) + 2]);
-
-                const float a = m_pixelBuffer[4 * (y * m_width + x) + 3];
-
-                line[4 * x + 0] = qMax(0, qMin(255, int(255.f * r)));
-                line[4 * x + 1] = qMax(0, qMin(255, int(255.f * g)));
-                line[4 * x + 2] = qMax(0, qMin(255, int(255.f * b)));
-                line[4 * x + 3] = qMax(0, qMin(255, int(255.f * a)));
-            }
+        // Detach once here rather than concurrently in each worker
+        unsigned char* const bits = m_image.bits();
 
-            if (m_imageEditingWatcher->isCanceled()) {
-                break;
-            }
-        }
+        const std::shared_ptr<const std::vector<unsigned char>> halfTable
+          = getHalfTable(m_exposure_mul);
+
+        const bool converted = convertImageTiles(
+          [&](const QRect& tile) {
+              convertRegion(tile, bits, m_exposure_mul, halfTable.get());
+          },
+          firstRegion);
 
         // We do not notify any canceled process: this would result in
         // potentially corrupted conversion
-        if (!m_imageEditingWatcher->isCanceled()) {
+        if (converted) {
             emit imageChanged();
         }
     });
 
     m_imageEditingWatcher->setFuture(imageConverting);
 }
+
+
+void RGBFramebufferModel::showLoadedLines(int yStart, int yEnd)
+{
+    // Lines of the image sampled from these lines of the framebuffer
+    const int step = getBufferStep();
+    const int y0   = (yStart + step - 1) / step;
+    const int y1   = std::min(m_image.height(), (yEnd + step) / step);
+
+    if (y1 > y0) {
+        updateImageLines(y0, y1, std::exp2(m_exposure));
+
+        emit imageRegionChanged(QRect(0, y0, m_image.width(), y1 - y0));
+    }
+}
+
+
+void RGBFramebufferModel::updateImageLines(
+  int yStart, int yEnd, float exposureMul)
+{
+    // Detach once here rather than concurrently in each worker
+    unsigned char* const bits = m_image.bits();
+
+    const std::shared_ptr<const std::vector<unsigned char>> halfTable
+      = getHalfTable(exposureMul);
+
+    // Lines are converted in parallel
+    ThreadPool::globalPool().parallelFor(
+      yStart,
+      yEnd,
+      [&](int64_t y0, int64_t y1) {
+          convertRegion(
+            QRect(0, y0, m_image.width(), y1 - y0),
+            bits,
+            exposureMul,
+            halfTable.get());
+      },
+      4);
+}
+
+
+void RGBFramebufferModel::convertRegion(
+  const QRect&                      region,
+  unsigned char*                    bits,
+  float                             exposureMul,
+  const std::vector<unsigned char>* halfTable) const
+{
+    const int    width        = region.width();
+    const int    step         = getBufferStep();
+    const int    bufferX      = region.x() * step;
+    const size_t bytesPerLine = m_image.bytesPerLine();
+
+    // Planes are read one line at a time
+    std::vector<float> a(width, 1.f);
+
+    if (halfTable) {
+        const unsigned char* table = halfTable->data();
+        std::vector<half>    hR(width), hG(width), hB(width);
+
+        for (int y = region.top(); y <= region.bottom(); y++) {
+            unsigned char* line = bits + y * bytesPerLine + 4 * region.x();
+
+            const int bufferY = getBufferLine(y);
+
+            m_planes[0]->getLine(bufferY, hR.data(), width, step, bufferX);
+            m_planes[1]->getLine(bufferY, hG.data(), width, step, bufferX);
+            m_planes[2]->getLine(bufferY, hB.data(), width, step, bufferX);
+
+            if (m_planes[3]) {
+                m_planes[3]->getLine(bufferY, a.data(), width, step, bufferX);
+            }
+
+            for (int x = 0; x < width; x++) {
+                line[4 * x + 0] = table[hR[x].bits()];
+                line[4 * x + 1] = table[hG[x].bits()];
+                line[4 * x + 2] = table[hB[x].bits()];
+                line[4 * x + 3] = qMax(0, qMin(255, int(255.f * a[x])));
+            }
+        }
+
+        return;
+    }
+
+    std::vector<float> r(width), g(width), b(width);
+
+    for (int y = region.top(); y <= region.bottom(); y++) {
+        unsigned char* line = bits + y * bytesPerLine + 4 * region.x();
+
+        const int bufferY = getBufferLine(y);
+
+        m_planes[0]->getLine(bufferY, r.data(), width, step, bufferX);
+
+        if (m_planes[1] == m_planes[0]) {
+            g = r;
+            b = r;
+        } else {
+            m_planes[1]->getLine(bufferY, g.data(), width, step, bufferX);
+            m_planes[2]->getLine(bufferY, b.data(), width, step, bufferX);
+        }
+
+        if (m_planes[3]) {
+            m_planes[3]->getLine(bufferY, a.data(), width, step, bufferX);
+        }
+
+        if (m_convertColors) {
+            for (int x = 0; x < width; x++) {
+                const Imath::V3f rgb
+                  = Imath::V3f(r[x], g[x], b[x]) * m_conversionMatrix;
+
+                r[x] = rgb.x;
+                g[x] = rgb.y;
+                b[x] = rgb.z;
+            }
+        }
+
+        // Exposure, encoding and quantization run vectorized
+        ColorTransform::to_sRGBA_255(
+          r.data(),
+          g.data(),
+          b.data(),
+          a.data(),
+          exposureMul,
+          line,
+          width);
+    }
+}
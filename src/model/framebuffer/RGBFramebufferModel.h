@@ -32,9 +32,23 @@
 
 #pragma once
 
+#include "ChannelPlane.h"
 #include "FramebufferModel.h"
+
+#include <OpenEXR/ImfChannelList.h>
+#include <OpenEXR/ImfChromaticities.h>
+#include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfInputPart.h>
 #include <OpenEXR/ImfMultiPartInputFile.h>
 
+#include <Imath/ImathMatrix.h>
+#include <Imath/ImathVec.h>
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 class RGBFramebufferModel: public FramebufferModel
 {
   public:
@@ -57,6 +71,8 @@ class RGBFramebufferModel: public FramebufferModel
 
     virtual std::string getColorInfo(int x, int y) const;
 
+    virtual void getPlanes(std::set<const ChannelPlane*>& planes) const;
+
     virtual float getRedInfo(int x, int y) const;
     virtual float getGreenInfo(int x, int y) const;
     virtual float getBlueInfo(int x, int y) const;
@@ -66,11 +82,97 @@ class RGBFramebufferModel: public FramebufferModel
     void setExposure(double value);
 
   protected:
-    void updateImage();
+    // Converts the image for display. When `visibleFirst`, the image is
+    // already shown and its part visible in the view is shown first.
+    void updateImage(bool visibleFirst = false);
+
+    virtual void reload() { load(*m_file, m_partID, m_hasAlpha); }
+
+    virtual void releasePixels() { m_planes = Planes(); }
+
+    // Converts the lines [yStart, yEnd[ of the framebuffer for display
+    void updateImageLines(int yStart, int yEnd, float exposureMul);
+
+    // Converts a region of the image into `bits`, the pixels of the image
+    // detached beforehand. `halfTable` is the table of getHalfTable.
+    void convertRegion(
+      const QRect&                      region,
+      unsigned char*                    bits,
+      float                             exposureMul,
+      const std::vector<unsigned char>* halfTable) const;
+
+    // Displays the lines of the image sampled from the lines [yStart, yEnd]
+    // of the framebuffer once they are loaded
+    void showLoadedLines(int yStart, int yEnd);
+
+    virtual void loadTiledRegion(int level, const QRect& region);
+
+    virtual void loadDataRegion(int imageLevel, const QRect& region);
 
   private:
-    int         m_partID;
+    // R, G, B and A planes. R, G and B share the same plane for Y layers and
+    // A is null when the layer has no alpha.
+    typedef std::array<std::shared_ptr<ChannelPlane>, 4> Planes;
+
+    Planes
+    createPlanes(const Imf::ChannelList& channels, int width, int height) const;
+
+    void insertColorSlices(
+      Imf::FrameBuffer&  framebuffer,
+      const Planes&      planes,
+      const Imath::V2i&  origin) const;
+
+    // Name of the channel stored in a plane, empty if the plane is not read
+    // directly from a channel
+    std::string getChannelName(int plane) const;
+
+    // Replaces the planes with the ones already decoded in the channel cache
+    // and returns the planes that still have to be read, the others being
+    // null
+    Planes shareCachedPlanes(int partId);
+
+    // Shares the decoded planes through the channel cache
+    void cachePlanes(int partId, const Planes& planes);
+
+    // Reads the lines [yStart, yEnd] of the non null planes
+    void
+    readBand(Imf::InputPart& part, const Planes& planes, int yStart, int yEnd);
+
+    // Reads luminance and chroma by bands, reconstructing RGB in the planes
+    // while keeping only a few lines in memory. Returns false when the load
+    // is abandoned.
+    bool loadYC(
+      Imf::InputPart&            part,
+      const Imf::Chromaticities& chromaticities,
+      bool                       readAlpha,
+      bool                       progressive,
+      int                        requestId);
+
+    // Display value of each half bit pattern for an exposure multiplier,
+    // the table is built again only when the exposure changes. Null when
+    // the planes are not all half or need a color conversion.
+    std::shared_ptr<const std::vector<unsigned char>>
+    getHalfTable(float exposureMul);
+
+    // Color of a pixel of the planes in the display primaries
+    Imath::V3f getRGB(int64_t index) const;
+    float      getAlpha(int64_t index) const;
+
     std::string m_parentLayer;
     LayerType   m_layerType;
     double      m_exposure;
+
+    Planes m_planes;
+    bool   m_hasAlpha;
+
+    // The planes keep the primaries of the file, the conversion to the
+    // display primaries is done when reading them
+    bool        m_convertColors;
+    Imath::M44f m_conversionMatrix;
+
+    // Half planes displayed without color conversion are converted with a
+    // table, shared with the conversions still using it
+    std::mutex                                        m_halfTableMutex;
+    std::shared_ptr<const std::vector<unsigned char>> m_halfTable;
+    float                                             m_halfTableExposure;
 };
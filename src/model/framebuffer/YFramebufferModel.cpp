@@ -31,23 +31,35 @@
  */
 
 #include "YFramebufferModel.h"
+#include "CoreDecoder.h"
+#include "DeepFlattener.h"
 
 #include <util/ColormapModule.h>
+#include <util/ThreadPool.h>
 
+#include <QElapsedTimer>
 #include <QFuture>
+#include <QMetaObject>
 #include <QtConcurrent/QtConcurrent>
 
 #include <OpenEXR/ImfAttribute.h>
+#include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfFrameBuffer.h>
 #include <OpenEXR/ImfHeader.h>
 #include <OpenEXR/ImfInputPart.h>
+#include <OpenEXR/ImfTiledInputPart.h>
 
 #include <Imath/ImathBox.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 YFramebufferModel::YFramebufferModel(
-  const std::string& layerName, QObject* parent)
+  const std::string& layerName, LayerType layerType, QObject* parent)
   : FramebufferModel(parent)
   , m_layer(layerName)
+  , m_layerType(layerType)
   , m_min(0.f)
   , m_max(1.f)
   , m_cmap(ColormapModule::create("grayscale"))
@@ -55,31 +67,58 @@ YFramebufferModel::YFramebufferModel(
 
 YFramebufferModel::~YFramebufferModel()
 {
+    cancelLoading();
     delete m_cmap;
 }
 
 void YFramebufferModel::load(Imf::MultiPartInputFile& file, int partId)
 {
-    QFuture<void> imageLoading = QtConcurrent::run([this, &file, partId]() {
+    m_file   = &file;
+    m_partID = partId;
+
+    // Id of the request this load belongs to, a region request replaces it
+    const int requestId = m_tiledRequest;
+
+    QFuture<void> imageLoading = QtConcurrent::run([this,
+                                                    &file,
+                                                    partId,
+                                                    requestId]() {
+        // Canceled before it even started
+        if (isLoadingCanceled()) {
+            return;
+        }
+
         try {
-            Imf::InputPart part(file, partId);
+            const Imf::Header& header = file.header(partId);
 
-            Imath::Box2i datW = part.header().dataWindow();
+            Imath::Box2i datW = header.dataWindow();
             m_width           = datW.max.x - datW.min.x + 1;
             m_height          = datW.max.y - datW.min.y + 1;
 
-            m_pixelAspectRatio = part.header().pixelAspectRatio();
+            m_pixelAspectRatio = header.pixelAspectRatio();
+
+            // The channel may already be decoded for another view
+            std::shared_ptr<ChannelPlane> cached
+              = m_channelCache ? m_channelCache->find(partId, m_layer)
+                               : nullptr;
+
+            // Subsampled channels, such as chroma, are displayed with their
+            // own resolution
+            const Imf::Channel* channel
+              = header.channels().findChannel(m_layer);
+
+            const int xSampling = channel ? channel->xSampling : 1;
+            const int ySampling = channel ? channel->ySampling : 1;
 
             Imf::Slice graySlice;
-            // TODO: Check it that can be guess from the header
-            // also, check if this can be nested
-            if (m_layer == "BY" || m_layer == "RY") {
-                m_width /= 2;
-                m_height /= 2;
+
+            if (xSampling > 1 || ySampling > 1) {
+                m_width  = (m_width - 1) / xSampling + 1;
+                m_height = (m_height - 1) / ySampling + 1;
 
                 m_dataWindow = QRect(datW.min.x, datW.min.y, m_width, m_height);
 
-                Imath::Box2i dispW = part.header().displayWindow();
+                Imath::Box2i dispW = header.displayWindow();
 
                 int dispW_width  = dispW.max.x - dispW.min.x + 1;
                 int dispW_height = dispW.max.y - dispW.min.y + 1;
@@ -87,37 +126,22 @@ void YFramebufferModel::load(Imf::MultiPartInputFile& file, int partId)
                 m_displayWindow = QRect(
                   dispW.min.x,
                   dispW.min.y,
-                  dispW_width / 2,
-                  dispW_height / 2);
-
-                // Check to avoid type overflow, width and height are 32bits int
-                // representing a 2 dimentional image. Can overflow the type when
-                // multiplied together
-                // TODO: Use larger type when manipulating framebuffer
-                const uint64_t partial_size
-                  = (uint64_t)m_width * (uint64_t)m_height;
-
-                if (partial_size > 0x7FFFFFFF) {
-                    throw std::runtime_error(
-                      "The total image size is too large. May be supported in "
-                      "a future revision.");
+                  dispW_width / xSampling,
+                  dispW_height / ySampling);
+
+                const std::shared_ptr<ChannelPlane> plane
+                  = cached ? cached : createPlane(header, m_width, m_height);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_memoryMutex);
+                    m_plane = plane;
                 }
 
-                m_pixelBuffer.resize(m_width * m_height);
-
-                // Luminance Chroma channels
-                graySlice = Imf::Slice::Make(
-                  Imf::PixelType::FLOAT,
-                  m_pixelBuffer.data(),
-                  datW,
-                  sizeof(float),
-                  m_width * sizeof(float),
-                  2,
-                  2);
+                graySlice = m_plane->slice(datW.min, xSampling, ySampling);
             } else {
                 m_dataWindow = QRect(datW.min.x, datW.min.y, m_width, m_height);
 
-                Imath::Box2i dispW = part.header().displayWindow();
+                Imath::Box2i dispW = header.displayWindow();
 
                 int dispW_width  = dispW.max.x - dispW.min.x + 1;
                 int dispW_height = dispW.max.y - dispW.min.y + 1;
@@ -125,34 +149,142 @@ void YFramebufferModel::load(Imf::MultiPartInputFile& file, int partId)
                 m_displayWindow
                   = QRect(dispW.min.x, dispW.min.y, dispW_width, dispW_height);
 
-                m_pixelBuffer.resize(m_width * m_height);
+                // Mipmapped parts are read by tiles once the view tells
+                // which ones are visible
+                if (initTiledStreaming(file, partId)) {
+                    loadDatasetRange(file, partId);
+
+                    m_isImageLoaded = true;
+                    emit imageLoaded();
+                    return;
+                }
+
+                const std::shared_ptr<ChannelPlane> plane
+                  = cached ? cached : createPlane(header, m_width, m_height);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_memoryMutex);
+                    m_plane = plane;
+                }
 
-                graySlice = Imf::Slice::Make(
-                  Imf::PixelType::FLOAT,
-                  m_pixelBuffer.data(),
-                  datW);
+                graySlice = m_plane->slice(datW.min);
             }
 
-            Imf::FrameBuffer framebuffer;
+            // The image is shown before the end of the load when it starts
+            // with a proxy
+            bool proxyShown = false;
+
+            if (!cached) {
+                // Deep parts are flattened while they are read
+                std::unique_ptr<Imf::InputPart> part;
+                std::unique_ptr<DeepFlattener>  flattener;
+                std::unique_ptr<CoreDecoder>    decoder;
+
+                if (DeepFlattener::isDeep(header)) {
+                    flattener.reset(new DeepFlattener(file, partId));
+
+                    if (m_layerType == Layer_SampleCount) {
+                        flattener->setSampleCountPlane(m_plane.get());
+                    } else {
+                        flattener->addChannel(m_layer, m_plane.get());
+                    }
+                } else if (
+                  isCoreDecoded(partId, std::vector<std::string>(1, m_layer))) {
+                    decoder.reset(new CoreDecoder(m_coreContext, partId));
+                    decoder->addChannel(m_layer, m_plane.get());
+                } else {
+                    Imf::FrameBuffer framebuffer;
+
+                    framebuffer.insert(m_layer, graySlice);
+
+                    part.reset(new Imf::InputPart(file, partId));
+                    part->setFrameBuffer(framebuffer);
+                }
+
+                // Large images are first shown with a few sampled lines
+                if (m_progressiveLoading && isProxyShown()) {
+                    initImage(QImage::Format_RGB888);
+                    m_image.fill(Qt::black);
+
+                    m_isImageLoaded = true;
+                    proxyShown      = true;
+
+                    emit imageLoaded();
+
+                    const bool shown = showSampledLines(
+                      header,
+                      requestId,
+                      [&](int y) {
+                          const int line = datW.min.y + y * ySampling;
+
+                          if (flattener) {
+                              flattener->readLines(line, line);
+                          } else if (decoder) {
+                              decoder->readLines(line, line);
+                          } else {
+                              part->readPixels(line, line);
+                          }
+                      },
+                      [&](int y) { updateImageLines(y, y + 1); });
+
+                    if (!shown) {
+                        return;
+                    }
+                }
 
-            framebuffer.insert(m_layer, graySlice);
+                // Read by bands to stop early when canceled
+                const int bandHeight = getBandHeight(header);
 
-            part.setFrameBuffer(framebuffer);
-            part.readPixels(datW.min.y, datW.max.y);
+                QElapsedTimer decodeTimer;
+                decodeTimer.start();
+
+                for (int yStart = datW.min.y; yStart <= datW.max.y;
+                     yStart += bandHeight) {
+                    if (isLoadingAbandoned(requestId)) {
+                        return;
+                    }
+
+                    const int yEnd
+                      = std::min(yStart + bandHeight - 1, datW.max.y);
+
+                    if (flattener) {
+                        flattener->readLines(yStart, yEnd);
+                    } else if (decoder) {
+                        decoder->readLines(yStart, yEnd);
+                    } else {
+                        part->readPixels(yStart, yEnd);
+                    }
+                }
+
+                logDecodeTime(
+                  partId,
+                  decoder != nullptr,
+                  decodeTimer.elapsed());
+
+                if (m_channelCache) {
+                    m_channelCache->insert(partId, m_layer, m_plane);
+                }
+            }
 
             // Determine min and max of the dataset
             m_datasetMin = std::numeric_limits<double>::infinity();
             m_datasetMax = -std::numeric_limits<double>::infinity();
 
-            for (int i = 0; i < m_width * m_height; i++) {
-                m_datasetMin = std::min(m_datasetMin, (double)m_pixelBuffer[i]);
-                m_datasetMax = std::max(m_datasetMax, (double)m_pixelBuffer[i]);
+            const size_t nPixels = (size_t)m_width * m_height;
+
+            for (size_t i = 0; i < nPixels; i++) {
+                const double value = m_plane->value(i);
+
+                m_datasetMin = std::min(m_datasetMin, value);
+                m_datasetMax = std::max(m_datasetMax, value);
             }
 
-            m_image         = QImage(m_width, m_height, QImage::Format_RGB888);
-            m_isImageLoaded = true;
+            if (!proxyShown) {
+                initImage(QImage::Format_RGB888);
+                m_isImageLoaded = true;
 
-            emit imageLoaded();
+                emit imageLoaded();
+            }
 
             updateImage();
         } catch (std::exception& e) {
@@ -161,18 +293,311 @@ void YFramebufferModel::load(Imf::MultiPartInputFile& file, int partId)
         }
     });
 
-    m_imageLoadingWatcher->setFuture(imageLoading);
+    addLoading(imageLoading);
+}
+
+
+std::shared_ptr<ChannelPlane> YFramebufferModel::createPlane(
+  const Imf::Header& header, int width, int height) const
+{
+    const Imf::Channel* channel = header.channels().findChannel(m_layer);
+
+    return std::make_shared<ChannelPlane>(
+      channel ? channel->type : Imf::FLOAT,
+      width,
+      height);
+}
+
+
+void YFramebufferModel::loadDatasetRange(
+  Imf::MultiPartInputFile& file, int partId)
+{
+    // The coarsest level is small and gives a good estimate of the range of
+    // the whole image
+    Imf::TiledInputPart part(file, partId);
+
+    const int          level = (int)m_levelSizes.size() - 1;
+    const Imath::Box2i levelDatW = part.dataWindowForLevel(level, level);
+    const QSize        size      = m_levelSizes[level];
+
+    std::vector<float> buffer((size_t)size.width() * size.height());
+
+    Imf::FrameBuffer framebuffer;
+    framebuffer.insert(
+      m_layer,
+      Imf::Slice::Make(
+        Imf::PixelType::FLOAT,
+        buffer.data(),
+        levelDatW));
+
+    part.setFrameBuffer(framebuffer);
+    part.readTiles(
+      0,
+      part.numXTiles(level) - 1,
+      0,
+      part.numYTiles(level) - 1,
+      level,
+      level);
+
+    m_datasetMin = std::numeric_limits<double>::infinity();
+    m_datasetMax = -std::numeric_limits<double>::infinity();
+
+    for (size_t i = 0; i < buffer.size(); i++) {
+        m_datasetMin = std::min(m_datasetMin, (double)buffer[i]);
+        m_datasetMax = std::max(m_datasetMax, (double)buffer[i]);
+    }
+}
+
+
+void YFramebufferModel::loadTiledRegion(int level, const QRect& region)
+{
+    const int requestId = ++m_tiledRequest;
+
+    const std::shared_ptr<ChannelPlane> plane = createPlane(
+      m_tiledFile->header(m_tiledPartID),
+      region.width(),
+      region.height());
+
+    // Keep the pixels already loaded at this level, only the missing tiles
+    // are read from the file
+    QRect loadedRegion;
+
+    if (m_plane && level == m_bufferLevel) {
+        loadedRegion = m_bufferRegion.intersected(region);
+
+        plane->copy(
+          *m_plane,
+          loadedRegion.x() - m_bufferRegion.x(),
+          loadedRegion.y() - m_bufferRegion.y(),
+          loadedRegion.x() - region.x(),
+          loadedRegion.y() - region.y(),
+          loadedRegion.width(),
+          loadedRegion.height());
+    }
+
+    QFuture<void> imageLoading = QtConcurrent::run([this,
+                                                    level,
+                                                    region,
+                                                    loadedRegion,
+                                                    plane,
+                                                    requestId]() {
+        try {
+            Imf::TiledInputPart part(*m_tiledFile, m_tiledPartID);
+
+            const Imath::Box2i levelDatW = part.dataWindowForLevel(level, level);
+
+            // Position of the plane in the level data window
+            const Imath::V2i origin(
+              levelDatW.min.x + region.left(),
+              levelDatW.min.y + region.top());
+
+            Imf::FrameBuffer framebuffer;
+
+            framebuffer.insert(m_layer, plane->slice(origin));
+
+            part.setFrameBuffer(framebuffer);
+
+            const int tileW = part.tileXSize();
+            const int tileH = part.tileYSize();
+
+            const int tx0 = region.left() / tileW;
+            const int tx1 = region.right() / tileW;
+            const int ty0 = region.top() / tileH;
+            const int ty1 = region.bottom() / tileH;
+
+            for (int ty = ty0; ty <= ty1; ty++) {
+                // A newer region was requested in the meantime
+                if (m_tiledRequest != requestId) {
+                    return;
+                }
+
+                int tx = tx0;
+
+                while (tx <= tx1) {
+                    const QRect tile
+                      = QRect(tx * tileW, ty * tileH, tileW, tileH)
+                          .intersected(region);
+
+                    if (loadedRegion.contains(tile)) {
+                        tx++;
+                        continue;
+                    }
+
+                    // Read consecutive missing tiles at once
+                    int txEnd = tx;
+
+                    while (txEnd + 1 <= tx1
+                           && !loadedRegion.contains(
+                             QRect((txEnd + 1) * tileW, ty * tileH, tileW, tileH)
+                               .intersected(region))) {
+                        txEnd++;
+                    }
+
+                    part.readTiles(tx, txEnd, ty, ty, level, level);
+
+                    tx = txEnd + 1;
+                }
+            }
+
+            // The planes are swapped in the thread owning the model so that
+            // pixel queries never see a partially replaced framebuffer
+            QMetaObject::invokeMethod(
+              this,
+              [this, level, region, plane, requestId]() {
+                  if (m_tiledRequest != requestId) {
+                      return;
+                  }
+
+                  if (m_imageEditingWatcher->isRunning()) {
+                      m_imageEditingWatcher->cancel();
+                      m_imageEditingWatcher->waitForFinished();
+                  }
+
+                  m_plane = plane;
+                  m_image = QImage(
+                    region.width(),
+                    region.height(),
+                    QImage::Format_RGB888);
+
+                  m_imageLevel   = level;
+                  m_imageRegion  = region;
+                  m_bufferLevel  = level;
+                  m_bufferRegion = region;
+
+                  updateImage();
+              },
+              Qt::QueuedConnection);
+        } catch (std::exception& e) {
+            emit loadFailed(e.what());
+            return;
+        }
+    });
+
+    addLoading(imageLoading);
+}
+
+void YFramebufferModel::loadDataRegion(int imageLevel, const QRect& region)
+{
+    const Imf::Header&  header  = m_file->header(m_partID);
+    const Imf::Channel* channel = header.channels().findChannel(m_layer);
+
+    // Subsampled channels and deep parts are only read as a whole
+    if (
+      !channel || channel->xSampling != 1 || channel->ySampling != 1
+      || DeepFlattener::isDeep(header)) {
+        return;
+    }
+
+    const int requestId = abandonLoadings();
+
+    const std::shared_ptr<ChannelPlane> plane
+      = createPlane(header, region.width(), region.height());
+
+    QFuture<void> imageLoading = QtConcurrent::run([this,
+                                                    imageLevel,
+                                                    region,
+                                                    plane,
+                                                    requestId]() {
+        try {
+            const Imf::Header&  header = m_file->header(m_partID);
+            const Imath::Box2i& datW   = header.dataWindow();
+
+            // Bands are decoded in their own plane, only the pixels in the
+            // region are kept
+            std::shared_ptr<ChannelPlane> bandPlane;
+
+            auto insertSlices = [&](Imf::FrameBuffer& framebuffer,
+                                    const QRect&      band) {
+                bandPlane = createPlane(header, band.width(), band.height());
+
+                framebuffer.insert(
+                  m_layer,
+                  bandPlane->slice(Imath::V2i(
+                    datW.min.x + band.left(),
+                    datW.min.y + band.top())));
+            };
+
+            auto copyBand = [&](const QRect& band) {
+                const QRect copied = band.intersected(region);
+
+                plane->copy(
+                  *bandPlane,
+                  copied.x() - band.x(),
+                  copied.y() - band.y(),
+                  copied.x() - region.x(),
+                  copied.y() - region.y(),
+                  copied.width(),
+                  copied.height());
+            };
+
+            if (!readRegionBands(region, requestId, insertSlices, copyBand)) {
+                return;
+            }
+
+            // The plane is swapped in the thread owning the model so that
+            // pixel queries never see a partially replaced framebuffer
+            QMetaObject::invokeMethod(
+              this,
+              [this, imageLevel, region, plane, requestId]() {
+                  if (m_tiledRequest != requestId) {
+                      return;
+                  }
+
+                  if (m_imageEditingWatcher->isRunning()) {
+                      m_imageEditingWatcher->cancel();
+                      m_imageEditingWatcher->waitForFinished();
+                  }
+
+                  m_plane = plane;
+
+                  m_imageLevel  = imageLevel;
+                  m_imageRegion = QRect(
+                    region.x() >> imageLevel,
+                    region.y() >> imageLevel,
+                    region.width() >> imageLevel,
+                    region.height() >> imageLevel);
+
+                  m_bufferLevel  = 0;
+                  m_bufferRegion = region;
+
+                  m_image = QImage(
+                    m_imageRegion.width(),
+                    m_imageRegion.height(),
+                    QImage::Format_RGB888);
+
+                  updateImage();
+              },
+              Qt::QueuedConnection);
+        } catch (std::exception& e) {
+            emit loadFailed(e.what());
+            return;
+        }
+    });
+
+    addLoading(imageLoading);
 }
 
+void YFramebufferModel::getPlanes(std::set<const ChannelPlane*>& planes) const
+{
+    std::lock_guard<std::mutex> lock(m_memoryMutex);
+
+    if (m_plane) {
+        planes.insert(m_plane.get());
+    }
+}
+
+
 std::string YFramebufferModel::getColorInfo(int x, int y) const
 {
-    if (x < 0 || x >= width() || y < 0 || y >= height()) {
+    const int64_t i = getBufferIndex(x, y);
+
+    if (i < 0) {
         return "";
     }
 
     std::stringstream ss;
     ss << "x: " << x << " y: " << y << " | "
-       << "value = " << m_pixelBuffer[y * width() + x];
+       << "value = " << m_plane->value(i);
 
     return ss.str();
 }
@@ -180,13 +605,13 @@ std::string YFramebufferModel::getColorInfo(int x, int y) const
 void YFramebufferModel::setMinValue(double value)
 {
     m_min = value;
-    updateImage();
+    updateImage(true);
 }
 
 void YFramebufferModel::setMaxValue(double value)
 {
     m_max = value;
-    updateImage();
+    updateImage(true);
 }
 
 void YFramebufferModel::setColormap(ColormapModule::Map map)
@@ -211,12 +636,13 @@ void YFramebufferModel::setColormap(ColormapModule::Map map)
 
     m_cmap = ColormapModule::create(map);
 
-    updateImage();
+    updateImage(true);
 }
 
-void YFramebufferModel::updateImage()
+void YFramebufferModel::updateImage(bool visibleFirst)
 {
-    if (!m_isImageLoaded) {
+    // The plane is released while the model is evicted
+    if (!m_isImageLoaded || !m_plane) {
         return;
     }
 
@@ -228,33 +654,72 @@ void YFramebufferModel::updateImage()
         m_imageEditingWatcher->waitForFinished();
     }
 
-    QFuture<void> imageConverting = QtConcurrent::run([=]() {
-        for (int y = 0; y < m_image.height(); y++) {
-            unsigned char* line = m_image.scanLine(y);
-
-            #pragma omp parallel for
-            for (int x = 0; x < m_image.width(); x++) {
-                float value = m_pixelBuffer[y * m_width + x];
-                float RGB[3];
+    const QRect firstRegion = visibleFirst ? getVisibleImageRect() : QRect();
 
-                m_cmap->getRGBValue(value, m_min, m_max, RGB);
-
-                for (int c = 0; c < 3; c++) {
-                    line[3 * x + c] = qMax(0, qMin(255, int(255 * RGB[c])));
-                }
-            }
+    QFuture<void> imageConverting = QtConcurrent::run([=]() {
+        // Detach once here rather than concurrently in each worker
+        unsigned char* const bits = m_image.bits();
 
-            if (m_imageEditingWatcher->isCanceled()) {
-                break;
-            }
-        }
+        const bool converted = convertImageTiles(
+          [&](const QRect& tile) { convertRegion(tile, bits); },
+          firstRegion);
 
         // We do not notify any canceled process: this would result in
         // potentially corrupted conversion
-        if (!m_imageEditingWatcher->isCanceled()) {
+        if (converted) {
             emit imageChanged();
         }
     });
 
     m_imageEditingWatcher->setFuture(imageConverting);
 }
+
+
+void YFramebufferModel::updateImageLines(int yStart, int yEnd)
+{
+    // Detach once here rather than concurrently in each worker
+    unsigned char* const bits = m_image.bits();
+
+    // Lines are converted in parallel
+    ThreadPool::globalPool().parallelFor(
+      yStart,
+      yEnd,
+      [&](int64_t y0, int64_t y1) {
+          convertRegion(QRect(0, y0, m_image.width(), y1 - y0), bits);
+      },
+      4);
+}
+
+
+void YFramebufferModel::convertRegion(
+  const QRect& region, unsigned char* bits) const
+{
+    const int    width        = region.width();
+    const int    step         = getBufferStep();
+    const size_t bytesPerLine = m_image.bytesPerLine();
+
+    // The plane is converted to float one line at a time
+    std::vector<float> values(width);
+
+    for (int y = region.top(); y <= region.bottom(); y++) {
+        unsigned char* line = bits + y * bytesPerLine + 3 * region.x();
+
+        m_plane->getLine(
+          getBufferLine(y),
+          values.data(),
+          width,
+          step,
+          region.x() * step);
+
+        for (int x = 0; x < width; x++) {
+            float value = values[x];
+            float RGB[3];
+
+            m_cmap->getRGBValue(value, m_min, m_max, RGB);
+
+            for (int c = 0; c < 3; c++) {
+                line[3 * x + c] = qMax(0, qMin(255, int(255 * RGB[c])));
+            }
+        }
+    }
+}
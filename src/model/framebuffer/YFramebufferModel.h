@@ -32,38 +32,78 @@
 
 #pragma once
 
+#include "ChannelPlane.h"
 #include "FramebufferModel.h"
 
 #include <util/ColormapModule.h>
+#include <OpenEXR/ImfHeader.h>
 #include <OpenEXR/ImfMultiPartInputFile.h>
 
+#include <memory>
+
 class YFramebufferModel: public FramebufferModel
 {
   public:
-    YFramebufferModel(const std::string& layerName, QObject* parent = nullptr);
+    enum LayerType
+    {
+        Layer_Channel,
+        // Number of samples of each pixel of a deep part
+        Layer_SampleCount,
+    };
+
+    YFramebufferModel(
+      const std::string& layerName,
+      LayerType          layerType = Layer_Channel,
+      QObject*           parent    = nullptr);
 
     virtual ~YFramebufferModel();
 
     virtual void load(Imf::MultiPartInputFile& file, int partId);
 
     const std::string& getLayerName() const { return m_layer; }
-    int                getPartId() const { return m_partID; }
 
     double              getDatasetMin() const { return m_datasetMin; }
     double              getDatasetMax() const { return m_datasetMax; }
     virtual std::string getColorInfo(int x, int y) const;
 
+    virtual void getPlanes(std::set<const ChannelPlane*>& planes) const;
+
   public slots:
     void setMinValue(double value);
     void setMaxValue(double value);
     void setColormap(ColormapModule::Map map);
 
   protected:
-    void updateImage();
+    // Converts the image for display. When `visibleFirst`, the image is
+    // already shown and its part visible in the view is shown first.
+    void updateImage(bool visibleFirst = false);
+
+    // Converts the lines [yStart, yEnd[ of the image for display
+    void updateImageLines(int yStart, int yEnd);
+
+    // Converts a region of the image into `bits`, the pixels of the image
+    // detached beforehand
+    void convertRegion(const QRect& region, unsigned char* bits) const;
+
+    virtual void reload() { load(*m_file, m_partID); }
+
+    virtual void releasePixels() { m_plane.reset(); }
+
+    virtual void loadTiledRegion(int level, const QRect& region);
+
+    virtual void loadDataRegion(int imageLevel, const QRect& region);
 
   private:
-    int         m_partID;
+    std::shared_ptr<ChannelPlane>
+    createPlane(const Imf::Header& header, int width, int height) const;
+
+    // Estimates the range of values of a streamed part
+    void loadDatasetRange(Imf::MultiPartInputFile& file, int partId);
+
     std::string m_layer;
+    LayerType   m_layerType;
+
+    std::shared_ptr<ChannelPlane> m_plane;
 
     double m_min;
     double m_max;
@@ -32,9 +32,343 @@
 
 #include "ColorTransform.h"
 
+#include <Imath/half.h>
+
 #include <cmath>
 #include <algorithm>
 
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) \
+  || defined(_M_IX86)
+#    define COLOR_TRANSFORM_X86
+#    include <immintrin.h>
+#    if defined(_MSC_VER) && !defined(__clang__)
+#        include <intrin.h>
+#    endif
+#endif
+
+// Vector kernels are compiled for their instruction set whatever the flags
+// of the build, and only called when the CPU supports it
+#if defined(__GNUC__) || defined(__clang__)
+#    define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#    define TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+#    define TARGET_AVX2
+#    define TARGET_SSE41
+#endif
+
+namespace
+{
+typedef void (*EncodeLine)(
+  const float*   r,
+  const float*   g,
+  const float*   b,
+  const float*   a,
+  float          exposure_mul,
+  unsigned char* rgba,
+  int            count);
+
+void encodeLineScalar(
+  const float*   r,
+  const float*   g,
+  const float*   b,
+  const float*   a,
+  float          exposure_mul,
+  unsigned char* rgba,
+  int            count)
+{
+    for (int x = 0; x < count; x++) {
+        const float sR = ColorTransform::to_sRGB(exposure_mul * r[x]);
+        const float sG = ColorTransform::to_sRGB(exposure_mul * g[x]);
+        const float sB = ColorTransform::to_sRGB(exposure_mul * b[x]);
+
+        rgba[4 * x + 0] = std::max(0, std::min(255, int(255.f * sR)));
+        rgba[4 * x + 1] = std::max(0, std::min(255, int(255.f * sG)));
+        rgba[4 * x + 2] = std::max(0, std::min(255, int(255.f * sB)));
+        rgba[4 * x + 3] = std::max(0, std::min(255, int(255.f * a[x])));
+    }
+}
+
+#ifdef COLOR_TRANSFORM_X86
+
+// Below this value, sRGB encoding is linear
+const float sRGBThreshold = 0.0031308f;
+
+// log2(1 + t) ~ t * (L0 + L1 t + ... + L4 t^4) for t in [0, 1[, with an
+// absolute error below 2e-5
+const float L0 = 1.4418799f;
+const float L1 = -0.708865217f;
+const float L2 = 0.415245559f;
+const float L3 = -0.193516522f;
+const float L4 = 0.0452682917f;
+
+// 2^f ~ 1 + f * (E0 + E1 f + ... + E4 f^4) for f in [0, 1[, with a
+// relative error below 2e-7
+const float E0 = 0.693152535f;
+const float E1 = 0.240152445f;
+const float E2 = 0.055836598f;
+const float E3 = 0.00897289928f;
+const float E4 = 0.0018854038f;
+
+// sRGB encoding of values in [0, 1]. x^(1/2.4) is computed as
+// 2^(log2(x) / 2.4) with the polynomials above: the encoded value is
+// within 1e-5 of the exact one.
+TARGET_AVX2 inline __m256 encodeAVX2(__m256 x)
+{
+    const __m256 one       = _mm256_set1_ps(1.f);
+    const __m256 threshold = _mm256_set1_ps(sRGBThreshold);
+
+    // log2(x) from the exponent and the mantissa of x
+    const __m256i bits = _mm256_castps_si256(_mm256_max_ps(x, threshold));
+
+    const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+      _mm256_srli_epi32(bits, 23),
+      _mm256_set1_epi32(127)));
+
+    const __m256 t = _mm256_sub_ps(
+      _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+        _mm256_set1_epi32(0x3f800000))),
+      one);
+
+    __m256 p = _mm256_set1_ps(L4);
+    p        = _mm256_fmadd_ps(p, t, _mm256_set1_ps(L3));
+    p        = _mm256_fmadd_ps(p, t, _mm256_set1_ps(L2));
+    p        = _mm256_fmadd_ps(p, t, _mm256_set1_ps(L1));
+    p        = _mm256_fmadd_ps(p, t, _mm256_set1_ps(L0));
+
+    const __m256 y = _mm256_mul_ps(
+      _mm256_fmadd_ps(p, t, e),
+      _mm256_set1_ps(1.f / 2.4f));
+
+    // 2^y from its integer and fractional parts
+    const __m256 i = _mm256_floor_ps(y);
+    const __m256 f = _mm256_sub_ps(y, i);
+
+    __m256 q = _mm256_set1_ps(E4);
+    q        = _mm256_fmadd_ps(q, f, _mm256_set1_ps(E3));
+    q        = _mm256_fmadd_ps(q, f, _mm256_set1_ps(E2));
+    q        = _mm256_fmadd_ps(q, f, _mm256_set1_ps(E1));
+    q        = _mm256_fmadd_ps(q, f, _mm256_set1_ps(E0));
+    q        = _mm256_fmadd_ps(q, f, one);
+
+    const __m256 power = _mm256_castsi256_ps(_mm256_add_epi32(
+      _mm256_castps_si256(q),
+      _mm256_slli_epi32(_mm256_cvtps_epi32(i), 23)));
+
+    // 1.055 x^(1/2.4) - 0.055, written to give exactly 1 for x = 1
+    const __m256 encoded = _mm256_fmadd_ps(
+      _mm256_set1_ps(0.055f),
+      _mm256_sub_ps(power, one),
+      power);
+
+    return _mm256_blendv_ps(
+      encoded,
+      _mm256_mul_ps(x, _mm256_set1_ps(12.92f)),
+      _mm256_cmp_ps(x, threshold, _CMP_LT_OQ));
+}
+
+// Clamps to [0, 1], NaNs giving 0
+TARGET_AVX2 inline __m256 clampAVX2(__m256 x)
+{
+    return _mm256_min_ps(
+      _mm256_max_ps(x, _mm256_setzero_ps()),
+      _mm256_set1_ps(1.f));
+}
+
+TARGET_AVX2 inline __m256i quantizeAVX2(__m256 x)
+{
+    return _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(255.f)));
+}
+
+TARGET_AVX2 void encodeLineAVX2(
+  const float*   r,
+  const float*   g,
+  const float*   b,
+  const float*   a,
+  float          exposure_mul,
+  unsigned char* rgba,
+  int            count)
+{
+    const __m256 mul = _mm256_set1_ps(exposure_mul);
+
+    int x = 0;
+
+    for (; x + 8 <= count; x += 8) {
+        const __m256 vR = clampAVX2(_mm256_mul_ps(mul, _mm256_loadu_ps(r + x)));
+        const __m256 vG = clampAVX2(_mm256_mul_ps(mul, _mm256_loadu_ps(g + x)));
+        const __m256 vB = clampAVX2(_mm256_mul_ps(mul, _mm256_loadu_ps(b + x)));
+        const __m256 vA = clampAVX2(_mm256_loadu_ps(a + x));
+
+        // Pixels are packed as 32 bits RGBA, little endian
+        const __m256i packed = _mm256_or_si256(
+          _mm256_or_si256(
+            quantizeAVX2(encodeAVX2(vR)),
+            _mm256_slli_epi32(quantizeAVX2(encodeAVX2(vG)), 8)),
+          _mm256_or_si256(
+            _mm256_slli_epi32(quantizeAVX2(encodeAVX2(vB)), 16),
+            _mm256_slli_epi32(quantizeAVX2(vA), 24)));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + 4 * x), packed);
+    }
+
+    encodeLineScalar(
+      r + x,
+      g + x,
+      b + x,
+      a + x,
+      exposure_mul,
+      rgba + 4 * x,
+      count - x);
+}
+
+// Same as encodeAVX2 with 4 lanes and without FMA
+TARGET_SSE41 inline __m128 encodeSSE41(__m128 x)
+{
+    const __m128 one       = _mm_set1_ps(1.f);
+    const __m128 threshold = _mm_set1_ps(sRGBThreshold);
+
+    const __m128i bits = _mm_castps_si128(_mm_max_ps(x, threshold));
+
+    const __m128 e = _mm_cvtepi32_ps(
+      _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+
+    const __m128 t = _mm_sub_ps(
+      _mm_castsi128_ps(_mm_or_si128(
+        _mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+        _mm_set1_epi32(0x3f800000))),
+      one);
+
+    __m128 p = _mm_set1_ps(L4);
+    p        = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(L3));
+    p        = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(L2));
+    p        = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(L1));
+    p        = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(L0));
+
+    const __m128 y = _mm_mul_ps(
+      _mm_add_ps(_mm_mul_ps(p, t), e),
+      _mm_set1_ps(1.f / 2.4f));
+
+    const __m128 i = _mm_floor_ps(y);
+    const __m128 f = _mm_sub_ps(y, i);
+
+    __m128 q = _mm_set1_ps(E4);
+    q        = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(E3));
+    q        = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(E2));
+    q        = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(E1));
+    q        = _mm_add_ps(_mm_mul_ps(q, f), _mm_set1_ps(E0));
+    q        = _mm_add_ps(_mm_mul_ps(q, f), one);
+
+    const __m128 power = _mm_castsi128_ps(_mm_add_epi32(
+      _mm_castps_si128(q),
+      _mm_slli_epi32(_mm_cvtps_epi32(i), 23)));
+
+    const __m128 encoded = _mm_add_ps(
+      _mm_mul_ps(_mm_set1_ps(0.055f), _mm_sub_ps(power, one)),
+      power);
+
+    return _mm_blendv_ps(
+      encoded,
+      _mm_mul_ps(x, _mm_set1_ps(12.92f)),
+      _mm_cmplt_ps(x, threshold));
+}
+
+TARGET_SSE41 inline __m128 clampSSE41(__m128 x)
+{
+    return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.f));
+}
+
+TARGET_SSE41 inline __m128i quantizeSSE41(__m128 x)
+{
+    return _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(255.f)));
+}
+
+TARGET_SSE41 void encodeLineSSE41(
+  const float*   r,
+  const float*   g,
+  const float*   b,
+  const float*   a,
+  float          exposure_mul,
+  unsigned char* rgba,
+  int            count)
+{
+    const __m128 mul = _mm_set1_ps(exposure_mul);
+
+    int x = 0;
+
+    for (; x + 4 <= count; x += 4) {
+        const __m128 vR = clampSSE41(_mm_mul_ps(mul, _mm_loadu_ps(r + x)));
+        const __m128 vG = clampSSE41(_mm_mul_ps(mul, _mm_loadu_ps(g + x)));
+        const __m128 vB = clampSSE41(_mm_mul_ps(mul, _mm_loadu_ps(b + x)));
+        const __m128 vA = clampSSE41(_mm_loadu_ps(a + x));
+
+        const __m128i packed = _mm_or_si128(
+          _mm_or_si128(
+            quantizeSSE41(encodeSSE41(vR)),
+            _mm_slli_epi32(quantizeSSE41(encodeSSE41(vG)), 8)),
+          _mm_or_si128(
+            _mm_slli_epi32(quantizeSSE41(encodeSSE41(vB)), 16),
+            _mm_slli_epi32(quantizeSSE41(vA), 24)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + 4 * x), packed);
+    }
+
+    encodeLineScalar(
+      r + x,
+      g + x,
+      b + x,
+      a + x,
+      exposure_mul,
+      rgba + 4 * x,
+      count - x);
+}
+
+#endif // COLOR_TRANSFORM_X86
+
+// Fastest kernel the CPU supports
+EncodeLine selectEncodeLine()
+{
+#if defined(COLOR_TRANSFORM_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return encodeLineAVX2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1")) {
+        return encodeLineSSE41;
+    }
+#elif defined(COLOR_TRANSFORM_X86) && defined(_MSC_VER)
+    int info[4];
+
+    __cpuid(info, 0);
+    const int nIds = info[0];
+
+    __cpuid(info, 1);
+    const bool sse41   = (info[2] & (1 << 19)) != 0;
+    const bool fma     = (info[2] & (1 << 12)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    // AVX registers must also be saved by the OS
+    bool avx2 = false;
+
+    if (nIds >= 7 && osxsave && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+
+    if (avx2 && fma) {
+        return encodeLineAVX2;
+    }
+
+    if (sse41) {
+        return encodeLineSSE41;
+    }
+#endif
+
+    return encodeLineScalar;
+}
+} // namespace
+
 float ColorTransform::to_sRGB(float rgb_color)
 {
     const double a = 0.055;
@@ -49,3 +383,38 @@ unsigned char ColorTransform::to_sRGB_255(float rgb_color)
     return (
       unsigned char)(255.f * to_sRGB(std::max(0.f, std::min(1.f, rgb_color))));
 }
+
+void ColorTransform::fill_sRGB_255_half_table(
+  float exposure_mul, unsigned char* table)
+{
+    for (int i = 0; i < 65536; i++) {
+        half h;
+        h.setBits(i);
+
+        const float value = h;
+
+        // Same quantization as the pixels converted one by one, NaNs
+        // being black
+        if (std::isnan(value)) {
+            table[i] = 0;
+        } else {
+            const float s = to_sRGB(exposure_mul * value);
+            table[i] = (unsigned char)(255.f * std::max(0.f, std::min(1.f, s)));
+        }
+    }
+}
+
+
+void ColorTransform::to_sRGBA_255(
+  const float*   r,
+  const float*   g,
+  const float*   b,
+  const float*   a,
+  float          exposure_mul,
+  unsigned char* rgba,
+  int            count)
+{
+    static const EncodeLine encodeLine = selectEncodeLine();
+
+    encodeLine(r, g, b, a, exposure_mul, rgba, count);
+}
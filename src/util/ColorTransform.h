@@ -37,4 +37,22 @@ class ColorTransform
   public:
     static float         to_sRGB(float rgb_color);
     static unsigned char to_sRGB_255(float rgb_color);
+
+    // Fills a table of 65536 entries giving the display value, from 0 to
+    // 255, of each half bit pattern once multiplied by `exposure_mul`
+    static void
+    fill_sRGB_255_half_table(float exposure_mul, unsigned char* table);
+
+    // Converts `count` linear pixels to 8 bits sRGB encoded RGBA, the color
+    // being multiplied by `exposure_mul` and alpha stored linearly. Uses
+    // AVX2 or SSE4.1 when the CPU supports them, with a polynomial power
+    // whose result may differ from `to_sRGB_255` by one level.
+    static void to_sRGBA_255(
+      const float*   r,
+      const float*   g,
+      const float*   b,
+      const float*   a,
+      float          exposure_mul,
+      unsigned char* rgba,
+      int            count);
 };
@@ -0,0 +1,306 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+thread_local ThreadPool* ThreadPool::t_pool  = nullptr;
+thread_local int         ThreadPool::t_index = -1;
+
+ThreadPool::ThreadPool(int nThreads)
+  : m_queued(0)
+  , m_pending(0)
+  , m_stop(false)
+  , m_nextWorker(0)
+{
+    startWorkers(nThreads);
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    finish();
+    stopWorkers();
+}
+
+
+ThreadPool& ThreadPool::globalPool()
+{
+    // Never destroyed: OpenEXR may still add tasks during static destruction
+    static ThreadPool* pool
+      = new ThreadPool(std::max(1u, std::thread::hardware_concurrency()));
+
+    return *pool;
+}
+
+
+int ThreadPool::getNumThreads() const
+{
+    return int(m_workers.size());
+}
+
+
+void ThreadPool::setNumThreads(int nThreads)
+{
+    nThreads = std::max(0, nThreads);
+
+    if (nThreads == getNumThreads()) {
+        return;
+    }
+
+    finish();
+    stopWorkers();
+    startWorkers(nThreads);
+}
+
+
+void ThreadPool::addTask(const std::function<void()>& task)
+{
+    if (m_workers.empty()) {
+        task();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_pending;
+    }
+
+    const int index = (t_pool == this)
+                        ? t_index
+                        : int(m_nextWorker++ % (unsigned int)m_workers.size());
+
+    {
+        std::lock_guard<std::mutex> lock(m_workers[index]->mutex);
+        m_workers[index]->tasks.push_back(task);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_queued;
+    }
+
+    m_wakeUp.notify_one();
+}
+
+
+void ThreadPool::parallelFor(
+  int64_t                                     begin,
+  int64_t                                     end,
+  const std::function<void(int64_t, int64_t)>& body,
+  int64_t                                     grainSize)
+{
+    if (end <= begin) {
+        return;
+    }
+
+    grainSize             = std::max(int64_t(1), grainSize);
+    const int64_t nChunks = (end - begin + grainSize - 1) / grainSize;
+
+    if (nChunks == 1 || m_workers.empty()) {
+        body(begin, end);
+        return;
+    }
+
+    struct State
+    {
+        std::atomic<int64_t>    next;
+        int64_t                 done;
+        std::exception_ptr      error;
+        std::mutex              mutex;
+        std::condition_variable finished;
+    };
+
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next                  = 0;
+    state->done                  = 0;
+
+    // The body is only accessed while a chunk is not done, so the caller's
+    // stack is still alive
+    const std::function<void(int64_t, int64_t)>* pBody = &body;
+
+    auto processChunks = [state, pBody, begin, end, grainSize, nChunks]() {
+        for (int64_t c = state->next++; c < nChunks; c = state->next++) {
+            const int64_t chunkBegin = begin + c * grainSize;
+            const int64_t chunkEnd   = std::min(end, chunkBegin + grainSize);
+
+            std::exception_ptr error;
+
+            try {
+                (*pBody)(chunkBegin, chunkEnd);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+
+            if (error && !state->error) {
+                state->error = error;
+            }
+
+            if (++state->done == nChunks) {
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    const int64_t nHelpers
+      = std::min(int64_t(m_workers.size()), nChunks - 1);
+
+    for (int64_t i = 0; i < nHelpers; i++) {
+        addTask(processChunks);
+    }
+
+    processChunks();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state, nChunks]() {
+        return state->done == nChunks;
+    });
+
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+
+void ThreadPool::finish()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_pending == 0; });
+}
+
+
+void ThreadPool::startWorkers(int nThreads)
+{
+    m_stop = false;
+
+    for (int i = 0; i < nThreads; i++) {
+        m_workers.emplace_back(new Worker);
+    }
+
+    for (int i = 0; i < nThreads; i++) {
+        m_workers[i]->thread = std::thread(&ThreadPool::run, this, i);
+    }
+}
+
+
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_wakeUp.notify_all();
+
+    for (auto& worker : m_workers) {
+        worker->thread.join();
+    }
+
+    m_workers.clear();
+}
+
+
+void ThreadPool::run(int index)
+{
+    t_pool  = this;
+    t_index = index;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeUp.wait(lock, [this]() { return m_queued > 0 || m_stop; });
+
+            if (m_queued == 0) {
+                return;
+            }
+
+            --m_queued;
+        }
+
+        std::function<void()> task;
+
+        // A task was counted as queued, it is in one of the queues
+        while (!popTask(index, task)) {
+            std::this_thread::yield();
+        }
+
+        try {
+            task();
+        } catch (...) {
+        }
+
+        task = nullptr;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (--m_pending == 0) {
+            m_idle.notify_all();
+        }
+    }
+}
+
+
+bool ThreadPool::popTask(int index, std::function<void()>& task)
+{
+    // Newest task from our own queue first
+    {
+        Worker&                     self = *m_workers[index];
+        std::lock_guard<std::mutex> lock(self.mutex);
+
+        if (!self.tasks.empty()) {
+            task = std::move(self.tasks.back());
+            self.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of another worker
+    const int nWorkers = int(m_workers.size());
+
+    for (int i = 1; i < nWorkers; i++) {
+        Worker&                     other = *m_workers[(index + i) % nWorkers];
+        std::lock_guard<std::mutex> lock(other.mutex);
+
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing thread pool running all the parallel work of the viewer:
+// pixel conversions and, through IlmThreadProvider, OpenEXR decoding. The
+// background work (channel prefetching, sequence frames) is added as short
+// tasks, a bounded number at a time, so it does not hold the workers.
+//
+// Each worker has its own queue. Tasks added from a worker go to its queue
+// and are processed last in first out, idle workers steal the oldest tasks
+// of the others.
+class ThreadPool
+{
+  public:
+    ThreadPool(int nThreads);
+    ~ThreadPool();
+
+    static ThreadPool& globalPool();
+
+    int getNumThreads() const;
+
+    // Waits for the running tasks before changing the number of workers.
+    // With no worker, tasks are run by the thread adding them.
+    void setNumThreads(int nThreads);
+
+    void addTask(const std::function<void()>& task);
+
+    // Calls body(chunkBegin, chunkEnd) over chunks of [begin, end[ of at
+    // least grainSize elements and returns once all of them are processed.
+    // The calling thread processes chunks as well, so this can be nested.
+    void parallelFor(
+      int64_t                                     begin,
+      int64_t                                     end,
+      const std::function<void(int64_t, int64_t)>& body,
+      int64_t                                     grainSize = 1);
+
+    // Waits until there is no task left
+    void finish();
+
+  private:
+    struct Worker
+    {
+        std::mutex                        mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread                       thread;
+    };
+
+    void startWorkers(int nThreads);
+    void stopWorkers();
+
+    void run(int index);
+    bool popTask(int index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_wakeUp;
+    std::condition_variable m_idle;
+
+    // Tasks waiting in a queue, and waiting or running
+    int64_t m_queued;
+    int64_t m_pending;
+    bool    m_stop;
+
+    std::atomic<unsigned int> m_nextWorker;
+
+    // Worker index of the current thread in this pool, -1 otherwise
+    static thread_local ThreadPool* t_pool;
+    static thread_local int         t_index;
+};
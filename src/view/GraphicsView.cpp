@@ -43,10 +43,13 @@
 #include <QScrollBar>
 #include <QUrl>
 
+#include <cmath>
+
 GraphicsView::GraphicsView(QWidget* parent)
   : QGraphicsView(parent)
   , _model(nullptr)
   , _imageItem(nullptr)
+  , _selectionBand(new QRubberBand(QRubberBand::Rectangle, this))
   , _zoomLevel(1.f)
   , _autoscale(true)
   , _showDataWindow(true)
@@ -77,11 +80,24 @@ void GraphicsView::setModel(const FramebufferModel* model)
     // clang-format off
     connect(_model, SIGNAL(imageChanged()), this, SLOT(onImageChanged()));
     connect(_model, SIGNAL(imageLoaded()),  this, SLOT(onImageLoaded()));
+    connect(_model, SIGNAL(imageRegionChanged(QRect)),
+            this,   SLOT(onImageRegionChanged(QRect)));
+    connect(this,   SIGNAL(visibleRegionChanged(QRect,double)),
+            _model, SLOT(setVisibleRegion(QRect,double)));
+    connect(this,   SIGNAL(regionSelected(QRect)),
+            _model, SLOT(loadRegion(QRect)));
+    connect(this,   SIGNAL(visibilityChanged(bool)),
+            _model, SLOT(setVisible(bool)));
     // clang-format on
+
+    emit visibilityChanged(isVisible());
 }
 
 void GraphicsView::onImageLoaded()
 {
+    const QRectF previousDataWindow    = _dataWindow;
+    const QRectF previousDisplayWindow = _displayWindow;
+
     _dataWindow    = _model->getDataWindow();
     _displayWindow = _model->getDisplayWindow();
 
@@ -109,8 +125,13 @@ void GraphicsView::onImageLoaded()
       -_dataWindow.topLeft().x(),
       -_dataWindow.topLeft().y());
 
-    // Fit view to display window
-    autoscale();
+    // Keep the zoom and position when the image is reloaded with the same
+    // windows, otherwise fit view to display window
+    if (
+      _imageItem == nullptr || _dataWindow != previousDataWindow
+      || _displayWindow != previousDisplayWindow) {
+        autoscale();
+    }
 }
 
 void GraphicsView::onImageChanged()
@@ -139,6 +160,56 @@ void GraphicsView::onImageChanged()
     } else {
         _imageItem = scene()->addPixmap(QPixmap::fromImage(loadedImage));
     }
+
+    // The image may only cover a region of a lower resolution level
+    const QRect region = _model->getImageRegion();
+    const int   scale  = 1 << _model->getImageLevel();
+
+    _imageItem->setScale(scale);
+    _imageItem->setPos(
+      region.x() * scale * _model->pixelAspectRatio(),
+      region.y() * scale);
+}
+
+void GraphicsView::onImageRegionChanged(const QRect& region)
+{
+    if (_model == nullptr) return;
+
+    if (_imageItem == nullptr) {
+        onImageChanged();
+        return;
+    }
+
+    const QImage& loadedImage = _model->getLoadedImage();
+    const float   aspect      = _model->pixelAspectRatio();
+
+    // Release the item's copy of the pixmap first so painting on it does not
+    // detach a full copy of the image
+    QPixmap pixmap = _imageItem->pixmap();
+    _imageItem->setPixmap(QPixmap());
+
+    {
+        QPainter painter(&pixmap);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+
+        if (aspect != 1.f) {
+            // Only the width is affected by pixelAspectRatio
+            const QImage aspectCorrectedRegion
+              = loadedImage.copy(region).scaled(
+                region.width() * aspect,
+                region.height(),
+                Qt::IgnoreAspectRatio,
+                Qt::SmoothTransformation);
+
+            painter.drawImage(
+              QPoint(region.x() * aspect, region.y()),
+              aspectCorrectedRegion);
+        } else {
+            painter.drawImage(region.topLeft(), loadedImage, region);
+        }
+    }
+
+    _imageItem->setPixmap(pixmap);
 }
 
 void GraphicsView::setZoomLevel(double zoom)
@@ -156,6 +227,8 @@ void GraphicsView::setZoomLevel(double zoom)
     _autoscale = false;
 
     emit zoomLevelChanged(zoom);
+
+    updateVisibleRegion();
 }
 
 void GraphicsView::zoomIn()
@@ -188,6 +261,8 @@ void GraphicsView::autoscale()
 
     // We want autoscale when loading a new image
     _autoscale = true;
+
+    updateVisibleRegion();
 }
 
 void GraphicsView::open(const QString& filename)
@@ -246,6 +321,20 @@ void GraphicsView::wheelEvent(QWheelEvent* event)
     }
 }
 
+void GraphicsView::showEvent(QShowEvent* event)
+{
+    QGraphicsView::showEvent(event);
+
+    emit visibilityChanged(true);
+}
+
+void GraphicsView::hideEvent(QHideEvent* event)
+{
+    QGraphicsView::hideEvent(event);
+
+    emit visibilityChanged(false);
+}
+
 void GraphicsView::resizeEvent(QResizeEvent*)
 {
     if (_model == nullptr || !_model->isImageLoaded()) return;
@@ -256,6 +345,8 @@ void GraphicsView::resizeEvent(QResizeEvent*)
         // Recenter the image
         resetTransform();
         scale(_zoomLevel, _zoomLevel);
+
+        updateVisibleRegion();
     }
 }
 
@@ -263,6 +354,16 @@ void GraphicsView::mousePressEvent(QMouseEvent* event)
 {
     if (_model == nullptr || !_model->isImageLoaded()) return;
 
+    // Shift + drag selects a region to read alone
+    if (
+      event->button() == Qt::LeftButton
+      && (event->modifiers() & Qt::ShiftModifier) != 0U) {
+        _startSelection = event->pos();
+        _selectionBand->setGeometry(QRect(_startSelection, QSize()));
+        _selectionBand->show();
+        return;
+    }
+
     if (
       (event->button() == Qt::MiddleButton)
       || (event->button() == Qt::LeftButton)) {
@@ -277,6 +378,12 @@ void GraphicsView::mouseMoveEvent(QMouseEvent* event)
 {
     if (_model == nullptr || !_model->isImageLoaded()) return;
 
+    if (_selectionBand->isVisible()) {
+        _selectionBand->setGeometry(
+          QRect(_startSelection, event->pos()).normalized());
+        return;
+    }
+
     if (
       ((event->buttons() & Qt::MiddleButton) != 0U)
       || ((event->buttons() & Qt::LeftButton) != 0U)) {
@@ -300,6 +407,33 @@ void GraphicsView::mouseReleaseEvent(QMouseEvent*)
 {
     if (_model == nullptr || !_model->isImageLoaded()) return;
 
+    if (_selectionBand->isVisible()) {
+        _selectionBand->hide();
+
+        const QRect selection = _selectionBand->geometry();
+
+        // A simple click clears the selection
+        if (selection.width() < 4 && selection.height() < 4) {
+            emit regionSelected(QRect());
+            return;
+        }
+
+        // The width of the scene is stretched by pixelAspectRatio
+        const QRectF sceneRect = mapToScene(selection).boundingRect();
+        const float  aspect    = _model->pixelAspectRatio();
+
+        const QRect region(
+          QPoint(
+            std::floor(sceneRect.left() / aspect),
+            std::floor(sceneRect.top())),
+          QPoint(
+            std::ceil(sceneRect.right() / aspect) - 1,
+            std::ceil(sceneRect.bottom()) - 1));
+
+        emit regionSelected(region);
+        return;
+    }
+
     setCursor(Qt::ArrowCursor);
 }
 
@@ -397,4 +531,26 @@ void GraphicsView::scrollContentsBy(int dx, int dy)
 
     // Problem with background drawing if not doing that...
     scene()->invalidate();
+
+    updateVisibleRegion();
+}
+
+void GraphicsView::updateVisibleRegion()
+{
+    if (_model == nullptr || !_model->isImageLoaded()) return;
+
+    const QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+    const float  aspect  = _model->pixelAspectRatio();
+
+    // Scene coordinates are stretched horizontally by pixelAspectRatio
+    const int x0 = std::floor(visible.left() / aspect);
+    const int y0 = std::floor(visible.top());
+    const int x1 = std::ceil(visible.right() / aspect);
+    const int y1 = std::ceil(visible.bottom());
+
+    const QRect region = QRect(x0, y0, x1 - x0 + 1, y1 - y0 + 1)
+                           .intersected(
+                             QRect(0, 0, _model->width(), _model->height()));
+
+    emit visibleRegionChanged(region, _zoomLevel);
 }
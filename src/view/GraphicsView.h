@@ -33,6 +33,7 @@
 #pragma once
 
 #include <QGraphicsView>
+#include <QRubberBand>
 
 #include <model/framebuffer/FramebufferModel.h>
 
@@ -50,6 +51,7 @@ class GraphicsView: public QGraphicsView
 
     void onImageLoaded();
     void onImageChanged();
+    void onImageRegionChanged(const QRect& region);
 
     void setZoomLevel(double zoom);
     void zoomIn();
@@ -67,9 +69,21 @@ class GraphicsView: public QGraphicsView
     void openFileOnDropEvent(const QString& filename);
     void queryPixelInfo(int x, int y);
 
+    // Part of the data window visible in the view, in image pixels
+    void visibleRegionChanged(const QRect& region, double zoom);
+
+    // Region of the data window selected with Shift + drag, in image pixels.
+    // The region is null when the selection is cleared.
+    void regionSelected(const QRect& region);
+
+    // The view is shown or hidden e.g., with its tab
+    void visibilityChanged(bool visible);
+
   protected:
     void wheelEvent(QWheelEvent* event) override;
     void resizeEvent(QResizeEvent* event) override;
+    void showEvent(QShowEvent* event) override;
+    void hideEvent(QHideEvent* event) override;
 
     void mousePressEvent(QMouseEvent* event) override;
     void mouseMoveEvent(QMouseEvent* event) override;
@@ -84,6 +98,8 @@ class GraphicsView: public QGraphicsView
     virtual void scrollContentsBy(int dx, int dy) override;
 
   private:
+    void updateVisibleRegion();
+
     const FramebufferModel* _model;
     QGraphicsPixmapItem*    _imageItem;
     //    QGraphicsRectItem *_datawindowItem;
@@ -91,6 +107,9 @@ class GraphicsView: public QGraphicsView
 
     QPoint _startDrag;
 
+    QRubberBand* _selectionBand;
+    QPoint       _startSelection;
+
     double _zoomLevel;
     bool   _autoscale;
 
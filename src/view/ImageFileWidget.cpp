@@ -34,29 +34,47 @@
 
 #include <QVBoxLayout>
 #include <QDir>
+#include <QFileInfo>
 #include <QMdiSubWindow>
 #include <QMessageBox>
+#include <QMetaObject>
+#include <QProgressBar>
 #include <QString>
+#include <QThread>
+#include <QtConcurrent/QtConcurrent>
 
 #include <model/OpenEXRImage.h>
 
 #include "RGBFramebufferWidget.h"
+#include "SequenceWidget.h"
 #include "YFramebufferWidget.h"
 
 ImageFileWidget::ImageFileWidget(const QString& filename, QWidget* parent)
   : QWidget(parent)
+  , m_openingWatcher(nullptr)
+  , m_fileWatcher(new QFileSystemWatcher(this))
+  , m_reloadTimer(new QTimer(this))
   , m_img(nullptr)
   , m_openedFolder(QDir::homePath())
   , m_isStream(false)
 {
     setupLayout();
 
+    m_reloadTimer->setSingleShot(true);
+    m_reloadTimer->setInterval(500);
+
     // clang-format off
     connect(m_attributesTreeView, SIGNAL(doubleClicked(QModelIndex)),
             this                , SLOT(onAttributeDoubleClicked(QModelIndex)));
 
     connect(m_layersTreeView    , SIGNAL(doubleClicked(QModelIndex)),
             this                , SLOT(onLayerDoubleClicked(QModelIndex)));
+
+    connect(m_fileWatcher       , SIGNAL(fileChanged(QString)),
+            this                , SLOT(onFileChanged(QString)));
+
+    connect(m_reloadTimer       , SIGNAL(timeout()),
+            this                , SLOT(onReloadTimeout()));
     // clang-format on
 
     // Open the file
@@ -64,8 +82,11 @@ ImageFileWidget::ImageFileWidget(const QString& filename, QWidget* parent)
 }
 
 
-ImageFileWidget::ImageFileWidget(std::istream& stream, QWidget* parent)
+ImageFileWidget::ImageFileWidget(int fd, QWidget* parent)
   : QWidget(parent)
+  , m_openingWatcher(nullptr)
+  , m_fileWatcher(new QFileSystemWatcher(this))
+  , m_reloadTimer(new QTimer(this))
   , m_img(nullptr)
   , m_openedFolder(QDir::homePath())
   , m_isStream(true)
@@ -82,12 +103,14 @@ ImageFileWidget::ImageFileWidget(std::istream& stream, QWidget* parent)
 
 
     // Open the file
-    open(stream);
+    open(fd);
 }
 
 
 ImageFileWidget::~ImageFileWidget()
 {
+    discardOpening();
+    cancelLoading();
     delete m_img;
 }
 
@@ -95,9 +118,6 @@ ImageFileWidget::~ImageFileWidget()
 
 void ImageFileWidget::refresh()
 {
-    // TODO:
-    // Better refresh handling: keep all window open, close those with no valid
-    // layer...
     if (!m_isStream) {
         open(m_openedFilename);
     }
@@ -105,6 +125,42 @@ void ImageFileWidget::refresh()
 
 
 
+void ImageFileWidget::openSequence()
+{
+    if (m_isStream) {
+        return;
+    }
+
+    const FrameSequence sequence(m_openedFilename);
+    const QString       title = tr("Sequence:") + " " + sequence.getPattern();
+
+    for (auto& w : m_mdiArea->subWindowList()) {
+        if (w->windowTitle() == title) {
+            w->setFocus();
+            return;
+        }
+    }
+
+    SequenceWidget* sequenceWidget = new SequenceWidget(sequence, m_mdiArea);
+    QMdiSubWindow*  subWindow      = m_mdiArea->addSubWindow(sequenceWidget);
+
+    subWindow->setWindowTitle(title);
+
+    switch (m_mdiArea->viewMode()) {
+        case QMdiArea::TabbedView:
+            subWindow->showMaximized();
+            break;
+
+        case QMdiArea::SubWindowView:
+            subWindow->resize(800, 600);
+            subWindow->show();
+            break;
+    }
+
+    sequenceWidget->setFocus();
+}
+
+
 void ImageFileWidget::setTabbed()
 {
     m_mdiArea->setViewMode(QMdiArea::TabbedView);
@@ -159,6 +215,23 @@ void ImageFileWidget::setupLayout()
 
     layout->addWidget(m_splitterImageView);
 
+    // Shown instead of the image while its file is opened
+    m_openingPlaceholder = new QWidget(this);
+    m_openingLabel       = new QLabel(m_openingPlaceholder);
+
+    QProgressBar* openingProgress = new QProgressBar(m_openingPlaceholder);
+    openingProgress->setRange(0, 0);
+
+    QVBoxLayout* openingLayout = new QVBoxLayout(m_openingPlaceholder);
+    openingLayout->addStretch();
+    openingLayout->addWidget(m_openingLabel, 0, Qt::AlignCenter);
+    openingLayout->addWidget(openingProgress);
+    openingLayout->addStretch();
+
+    m_openingPlaceholder->hide();
+
+    layout->addWidget(m_openingPlaceholder);
+
     setLayout(layout);
 }
 
@@ -212,6 +285,10 @@ QString ImageFileWidget::getTitle(const LayerItem* item)
               = "Layer: " + QString::fromStdString(item->getOriginalFullName());
             break;
 
+        case LayerItem::SAMPLE_COUNT:
+            layerName = tr("Sample count");
+            break;
+
         case LayerItem::GROUP:
         case LayerItem::PART:
             layerName = "";
@@ -246,6 +323,31 @@ QString ImageFileWidget::getTitle(const LayerItem* item)
 }
 
 
+const LayerItem*
+ImageFileWidget::findLayer(const LayerItem* item, const QString& title)
+{
+    if (!item) {
+        return nullptr;
+    }
+
+    if (
+      item->getType() != LayerItem::GROUP && item->getType() != LayerItem::PART
+      && getTitle(item) == title) {
+        return item;
+    }
+
+    for (const LayerItem* child : item->children()) {
+        const LayerItem* found = findLayer(child, title);
+
+        if (found) {
+            return found;
+        }
+    }
+
+    return nullptr;
+}
+
+
 void ImageFileWidget::openAttribute(const HeaderItem* item)
 {
     if (item->getLayerItem() != nullptr) {
@@ -254,7 +356,7 @@ void ImageFileWidget::openAttribute(const HeaderItem* item)
 }
 
 
-void ImageFileWidget::openLayer(const LayerItem* item)
+FramebufferModel* ImageFileWidget::openLayer(const LayerItem* item)
 {
     QString title = getTitle(item);
 
@@ -262,10 +364,14 @@ void ImageFileWidget::openLayer(const LayerItem* item)
     for (auto& w : m_mdiArea->subWindowList()) {
         if (w->windowTitle() == title) {
             w->setFocus();
-            return;
+            return nullptr;
         }
     }
 
+    // The requested layer comes first: the prefetching pauses without
+    // waiting and keeps what it decoded
+    m_img->getPrefetcher().cancel();
+
     // If the window does not exist yet, create it
     YFramebufferWidget*   graphicViewBW = nullptr;
     YFramebufferModel*    imageModelBW  = nullptr;
@@ -297,6 +403,8 @@ void ImageFileWidget::openLayer(const LayerItem* item)
 
             graphicView->setModel(imageModel);
 
+            imageModel->setChannelCache(&m_img->getChannelCache());
+            imageModel->setCoreContext(m_img->getCoreContext());
             imageModel->load(
               m_img->getEXR(),
               item->getPart(),
@@ -328,6 +436,8 @@ void ImageFileWidget::openLayer(const LayerItem* item)
 
             graphicView->setModel(imageModel);
 
+            imageModel->setChannelCache(&m_img->getChannelCache());
+            imageModel->setCoreContext(m_img->getCoreContext());
             imageModel->load(
               m_img->getEXR(),
               item->getPart(),
@@ -361,6 +471,8 @@ void ImageFileWidget::openLayer(const LayerItem* item)
 
             graphicView->setModel(imageModel);
 
+            imageModel->setChannelCache(&m_img->getChannelCache());
+            imageModel->setCoreContext(m_img->getCoreContext());
             imageModel->load(
               m_img->getEXR(),
               item->getPart(),
@@ -377,6 +489,35 @@ void ImageFileWidget::openLayer(const LayerItem* item)
             graphicViewBW = new YFramebufferWidget(m_mdiArea);
             imageModelBW  = new YFramebufferModel(
               item->getOriginalFullName(),
+              YFramebufferModel::Layer_Channel,
+              graphicViewBW);
+
+            QObject::connect(
+              imageModelBW,
+              SIGNAL(loadFailed(QString)),
+              this,
+              SLOT(onLoadFailed(QString)));
+
+            QObject::connect(
+              graphicViewBW,
+              SIGNAL(openFileOnDropEvent(QString)),
+              this,
+              SLOT(onOpenFileDropEvent(QString)));
+
+            graphicViewBW->setModel(imageModelBW);
+
+            imageModelBW->setChannelCache(&m_img->getChannelCache());
+            imageModelBW->setCoreContext(m_img->getCoreContext());
+            imageModelBW->load(m_img->getEXR(), item->getPart());
+
+            subWindow = m_mdiArea->addSubWindow(graphicViewBW);
+            break;
+
+        case LayerItem::SAMPLE_COUNT:
+            graphicViewBW = new YFramebufferWidget(m_mdiArea);
+            imageModelBW  = new YFramebufferModel(
+              item->getOriginalFullName(),
+              YFramebufferModel::Layer_SampleCount,
               graphicViewBW);
 
             QObject::connect(
@@ -418,10 +559,30 @@ void ImageFileWidget::openLayer(const LayerItem* item)
                 break;
         }
     }
+
+    FramebufferModel* model = imageModel;
+
+    if (!model) {
+        model = imageModelBW;
+    }
+
+    // The prefetching resumes once the requested layer is read
+    if (model) {
+        connect(model, SIGNAL(loadFinished()), this, SLOT(startPrefetch()));
+        connect(
+          model,
+          SIGNAL(loadFailed(QString)),
+          this,
+          SLOT(startPrefetch()));
+    } else {
+        startPrefetch();
+    }
+
+    return model;
 }
 
 
-void ImageFileWidget::open(const QString& filename)
+void ImageFileWidget::open(const QString& filename, bool reportErrors)
 {
     assert(!m_isStream);
 
@@ -429,70 +590,218 @@ void ImageFileWidget::open(const QString& filename)
     m_openedFilename = filename;
     m_openedFolder   = QFileInfo(m_openedFilename).absolutePath();
 
-    // Attempt opening the image
-    OpenEXRImage* imageLoaded = nullptr;
+    // Writers often replace the file, which stops watching it
+    if (!m_fileWatcher->files().contains(filename)) {
+        m_fileWatcher->addPath(filename);
+    }
+
+    openAsync(
+      [filename]() { return new OpenEXRImage(filename, nullptr); },
+      QFileInfo(filename).fileName(),
+      reportErrors);
+}
 
-    try {
-        imageLoaded = new OpenEXRImage(m_openedFilename, this);
-    } catch (std::exception& e) {
-        onLoadFailed(e.what());
 
-        delete imageLoaded;
+void ImageFileWidget::open(int fd)
+{
+    assert(m_isStream);
 
-        return;
+    openAsync(
+      [fd]() { return new OpenEXRImage(fd, nullptr); },
+      tr("stream"));
+}
+
+
+void ImageFileWidget::openAsync(
+  const std::function<OpenEXRImage*()>& createImage,
+  const QString&                        name,
+  bool                                  reportErrors)
+{
+    // Only the last requested image is kept
+    discardOpening();
+
+    // A reopened image stays displayed until the new one is ready
+    if (!m_img) {
+        m_openingLabel->setText(tr("Opening %1...").arg(name));
+        m_splitterImageView->hide();
+        m_openingPlaceholder->show();
     }
 
-    // No error so far, continue normal execution
-    if (m_img) {
-        m_mdiArea->closeAllSubWindows();
-        m_attributesTreeView->setModel(nullptr);
-        m_layersTreeView->setModel(nullptr);
-        delete m_img;
-        m_img = nullptr;
+    QThread* guiThread = thread();
+
+    // The worker does not use the widget, which may be closed before the
+    // image is opened
+    QFuture<OpenedImage> opening = QtConcurrent::run(
+      [createImage, guiThread, reportErrors]() -> OpenedImage {
+          try {
+              OpenEXRImage* image = createImage();
+
+              // Its models are used by the views of the GUI thread
+              image->moveToThread(guiThread);
+
+              return {image, QString()};
+          } catch (std::exception& e) {
+              // A file still being written is read again on its next
+              // change
+              if (!reportErrors) {
+                  std::cerr << "Reloading error: " << e.what() << std::endl;
+                  return {nullptr, QString()};
+              }
+
+              return {nullptr, e.what()};
+          }
+      });
+
+    m_openingWatcher = new QFutureWatcher<OpenedImage>(this);
+
+    connect(m_openingWatcher, SIGNAL(finished()), this, SLOT(onImageOpened()));
+
+    m_openingWatcher->setFuture(opening);
+}
+
+
+void ImageFileWidget::discardOpening()
+{
+    if (!m_openingWatcher) {
+        return;
     }
 
-    //    m_statusBarMessage->setText(filename);
+    // The opening is left running: its image is deleted once it is ready
+    QFutureWatcher<OpenedImage>* watcher = m_openingWatcher;
+    m_openingWatcher                     = nullptr;
 
-    m_img = imageLoaded;
+    watcher->disconnect(this);
+    watcher->setParent(nullptr);
 
-    afterOpen();
+    QObject::connect(watcher, &QFutureWatcherBase::finished, [watcher]() {
+        delete watcher->result().image;
+        watcher->deleteLater();
+    });
 }
 
 
-void ImageFileWidget::open(std::istream& stream)
+void ImageFileWidget::onImageOpened()
 {
-    assert(m_isStream);
+    if (!m_openingWatcher) {
+        return;
+    }
+
+    const OpenedImage opened = m_openingWatcher->result();
+
+    m_openingWatcher->deleteLater();
+    m_openingWatcher = nullptr;
 
-    // Attempt opening the image
-    OpenEXRImage* imageLoaded = nullptr;
+    m_openingPlaceholder->hide();
+    m_splitterImageView->show();
 
-    try {
-        imageLoaded = new OpenEXRImage(stream, this);
-    } catch (std::exception& e) {
-        onLoadFailed(e.what());
+    OpenEXRImage* imageLoaded = opened.image;
 
-        delete imageLoaded;
+    if (!imageLoaded) {
+        if (!opened.error.isEmpty()) {
+            onLoadFailed(opened.error);
+        }
 
         return;
     }
 
+    imageLoaded->setParent(this);
+
     // No error so far, continue normal execution
     if (m_img) {
-        m_mdiArea->closeAllSubWindows();
-        m_attributesTreeView->setModel(nullptr);
-        m_layersTreeView->setModel(nullptr);
-        delete m_img;
-        m_img = nullptr;
+        replaceImage(imageLoaded);
+        return;
     }
 
-    //    m_statusBarMessage->setText(filename);
-
     m_img = imageLoaded;
 
     afterOpen();
 }
 
 
+void ImageFileWidget::replaceImage(OpenEXRImage* image)
+{
+    OpenEXRImage* previous = m_img;
+
+    // The previous file is about to be closed
+    previous->getPrefetcher().cancel();
+
+    // Reading the chunks of both versions, each part is compared once
+    const int         nParts = image->getEXR().parts();
+    std::vector<bool> sameParts(nParts, false);
+
+    for (int part = 0; part < nParts; part++) {
+        sameParts[part] = image->hasSamePart(*previous, part);
+
+        if (sameParts[part]) {
+            image->getChannelCache().import(previous->getChannelCache(), part);
+        }
+    }
+
+    QList<FramebufferModel*> reloadedModels;
+
+    for (QMdiSubWindow* subWindow : m_mdiArea->subWindowList()) {
+        FramebufferModel* model = subWindow->findChild<FramebufferModel*>();
+        const LayerItem*  item  = findLayer(
+          image->getLayerModel()->getRoot(),
+          subWindow->windowTitle());
+
+        // Not a layer e.g., a sequence
+        if (!model) {
+            continue;
+        }
+
+        // The layer is gone
+        if (!item) {
+            model->cancelLoading();
+            subWindow->close();
+            continue;
+        }
+
+        const bool partChanged = item->getPart() < 0
+                                 || item->getPart() >= nParts
+                                 || !sameParts[item->getPart()];
+
+        model->switchFile(
+          image->getEXR(),
+          &image->getChannelCache(),
+          image->getCoreContext(),
+          partChanged);
+
+        if (partChanged) {
+            reloadedModels.append(model);
+        }
+    }
+
+    m_attributesTreeView->setModel(nullptr);
+    m_layersTreeView->setModel(nullptr);
+    delete previous;
+
+    m_img = image;
+
+    if (m_mdiArea->subWindowList().isEmpty()) {
+        afterOpen();
+        return;
+    }
+
+    m_attributesTreeView->setModel(m_img->getHeaderModel());
+    m_attributesTreeView->expandAll();
+    m_attributesTreeView->resizeColumnToContents(0);
+
+    m_layersTreeView->setModel(m_img->getLayerModel());
+    m_layersTreeView->expandAll();
+    m_layersTreeView->resizeColumnToContents(0);
+
+    // The other channels are decoded once the displayed ones are read again
+    if (reloadedModels.isEmpty()) {
+        startPrefetch();
+    }
+
+    for (FramebufferModel* model : reloadedModels) {
+        connect(model, SIGNAL(loadFinished()), this, SLOT(startPrefetch()));
+    }
+}
+
+
 void ImageFileWidget::afterOpen()
 {
     m_attributesTreeView->setModel(m_img->getHeaderModel());
@@ -507,7 +816,45 @@ void ImageFileWidget::afterOpen()
 }
 
 
+void ImageFileWidget::cancelLoading()
+{
+    // Sub windows are deleted later, their models may still be loading
+    for (FramebufferModel* model :
+         m_mdiArea->findChildren<FramebufferModel*>()) {
+        model->cancelLoading();
+    }
+}
+
+
 void ImageFileWidget::openDefaultLayer()
+{
+    const LayerItem* item = getDefaultLayer();
+
+    // The other channels are decoded once the default layer is displayed
+    if (item) {
+        openLayer(item);
+    } else {
+        startPrefetch();
+    }
+}
+
+
+void ImageFileWidget::startPrefetch()
+{
+    // Resumed once the last model being loaded is done, so the prefetcher
+    // does not compete with it
+    for (FramebufferModel* model :
+         m_mdiArea->findChildren<FramebufferModel*>()) {
+        if (model->isLoading()) {
+            return;
+        }
+    }
+
+    m_img->getPrefetcher().start();
+}
+
+
+const LayerItem* ImageFileWidget::getDefaultLayer() const
 {
     // Detect if there is a root RGB or YC layer group
     LayerItem const* r = m_img->getLayerModel()->getRoot();
@@ -517,38 +864,32 @@ void ImageFileWidget::openDefaultLayer()
 
         child = r->child(LayerItem::RGBA);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         child = r->child(LayerItem::RGB);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         child = r->child(LayerItem::YCA);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         child = r->child(LayerItem::YC);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         child = r->child(LayerItem::YA);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         child = r->child(LayerItem::Y);
         if (child) {
-            openLayer(child);
-            return;
+            return child;
         }
 
         // When all children are parts, try to find a part with a displayable layer
@@ -556,41 +897,37 @@ void ImageFileWidget::openDefaultLayer()
         for (LayerItem* rr : r->children()) {
             child = rr->child(LayerItem::RGBA);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
 
             child = rr->child(LayerItem::RGB);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
 
             child = rr->child(LayerItem::YCA);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
 
             child = rr->child(LayerItem::YC);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
 
             child = rr->child(LayerItem::YA);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
 
             child = rr->child(LayerItem::Y);
             if (child) {
-                openLayer(child);
-                return;
+                return child;
             }
         }
     }
+
+    return nullptr;
 }
 
 
@@ -624,3 +961,25 @@ void ImageFileWidget::onOpenFileDropEvent(const QString& filename)
 {
     emit openFileOnDropEvent(filename);
 }
+
+
+void ImageFileWidget::onFileChanged(const QString& path)
+{
+    if (path != m_openedFilename) {
+        return;
+    }
+
+    // Restarted at each change until the writer is done
+    m_reloadTimer->start();
+}
+
+
+void ImageFileWidget::onReloadTimeout()
+{
+    // Removed for good rather than replaced
+    if (!QFileInfo::exists(m_openedFilename)) {
+        return;
+    }
+
+    open(m_openedFilename, false);
+}
@@ -34,12 +34,18 @@
 
 #include <QWidget>
 
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QLabel>
 #include <QMdiArea>
 #include <QSplitter>
+#include <QTimer>
 #include <QTreeView>
 
 #include <model/OpenEXRImage.h>
 
+#include <functional>
+
 class ImageFileWidget: public QWidget
 {
     Q_OBJECT
@@ -47,7 +53,7 @@ class ImageFileWidget: public QWidget
     explicit ImageFileWidget(
       const QString& filename, QWidget* parent = nullptr);
 
-    explicit ImageFileWidget(std::istream& stream, QWidget* parent = nullptr);
+    explicit ImageFileWidget(int fd, QWidget* parent = nullptr);
 
     virtual ~ImageFileWidget();
 
@@ -76,6 +82,9 @@ class ImageFileWidget: public QWidget
 
     bool isStream() const { return m_isStream; }
 
+    // Plays the sequence the file belongs to in a new window
+    void openSequence();
+
   signals:
     void openFileOnDropEvent(const QString& filename);
 
@@ -92,25 +101,60 @@ class ImageFileWidget: public QWidget
     void setupLayout();
 
     static QString getTitle(const LayerItem* item);
+
+    // Displayable layer of the tree with the given window title, if any
+    static const LayerItem*
+    findLayer(const LayerItem* item, const QString& title);
     QString        getTitle(int partId, const std::string& layer) const;
     void           openAttribute(const HeaderItem* item);
 
-    void openLayer(const LayerItem* item);
+    // Opens the layer in a new window and returns its model, or null if
+    // the layer is already opened or cannot be displayed
+    FramebufferModel* openLayer(const LayerItem* item);
+
+    void open(const QString& filename, bool reportErrors = true);
+    void open(int fd);
 
-    void open(const QString& filename);
-    void open(std::istream& stream);
+    // Creates the image on a worker thread so a slow file system does not
+    // freeze the window, a placeholder is shown meanwhile
+    void openAsync(
+      const std::function<OpenEXRImage*()>& createImage,
+      const QString&                        name,
+      bool                                  reportErrors = true);
+
+    // Drops the image being opened, if any, without waiting for it
+    void discardOpening();
 
     void afterOpen();
-    void openDefaultLayer();
+
+    // Replaces the displayed image with a new version of its file. The
+    // windows of the layers still present are kept and only the parts which
+    // changed are read again.
+    void replaceImage(OpenEXRImage* image);
+
+    const LayerItem* getDefaultLayer() const;
+    void             openDefaultLayer();
+
+    // Stops the loads of all the opened layers, to be done before closing
+    // the file they read from
+    void cancelLoading();
 
   private slots:
     void onAttributeDoubleClicked(const QModelIndex& index);
     void onLayerDoubleClicked(const QModelIndex& index);
 
+    void onImageOpened();
+
     void onLoadFailed(const QString& msg);
 
     void onOpenFileDropEvent(const QString& filename);
 
+    void onFileChanged(const QString& path);
+    void onReloadTimeout();
+
+    // Decodes the channels not displayed yet in the background
+    void startPrefetch();
+
   private:
     QSplitter* m_splitterImageView;
     QSplitter* m_splitterProperties;
@@ -118,6 +162,22 @@ class ImageFileWidget: public QWidget
     QTreeView* m_layersTreeView;
     QMdiArea*  m_mdiArea;
 
+    // Image created on a worker thread, or the error preventing it
+    struct OpenedImage
+    {
+        OpenEXRImage* image;
+        QString       error;
+    };
+
+    QWidget*                     m_openingPlaceholder;
+    QLabel*                      m_openingLabel;
+    QFutureWatcher<OpenedImage>* m_openingWatcher;
+
+    // The file is read again once it has not changed for a while, so a
+    // file still being written is not reloaded at each write
+    QFileSystemWatcher* m_fileWatcher;
+    QTimer*             m_reloadTimer;
+
     OpenEXRImage* m_img;
     QString       m_openedFolder;
     QString       m_openedFilename;
@@ -0,0 +1,178 @@
+/**
+ * Copyright (c) 2021 Alban Fichet <alban dot fichet at gmx dot fr>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following
+ * disclaimer in the documentation and/or other materials provided
+ * with the distribution.
+ *  * Neither the name of the organization(s) nor the names of its
+ * contributors may be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "SequenceWidget.h"
+
+#include <QHBoxLayout>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QVBoxLayout>
+
+SequenceWidget::SequenceWidget(const FrameSequence& sequence, QWidget* parent)
+  : QWidget(parent)
+  , m_player(new SequencePlayer(sequence, this))
+  , m_controls(new QWidget(this))
+  , m_playButton(new QToolButton(m_controls))
+  , m_frameSlider(new QSlider(Qt::Horizontal, m_controls))
+  , m_frameLabel(new QLabel(m_controls))
+  , m_fpsSpinBox(new QDoubleSpinBox(m_controls))
+  , m_exposureSpinBox(new QDoubleSpinBox(m_controls))
+  , m_statisticsLabel(new QLabel(m_controls))
+{
+    setFocusPolicy(Qt::StrongFocus);
+
+    m_playButton->setText(tr("Play"));
+
+    m_frameSlider->setRange(0, sequence.size() - 1);
+    m_frameSlider->setValue(m_player->getCurrentFrame());
+
+    m_fpsSpinBox->setRange(1., 120.);
+    m_fpsSpinBox->setDecimals(2);
+    m_fpsSpinBox->setValue(m_player->getFps());
+    m_fpsSpinBox->setSuffix(" " + tr("fps"));
+
+    m_exposureSpinBox->setRange(-20., 20.);
+    m_exposureSpinBox->setSingleStep(0.5);
+    m_exposureSpinBox->setPrefix(tr("Exposure:") + " ");
+
+    QHBoxLayout* controlsLayout = new QHBoxLayout(m_controls);
+    controlsLayout->addWidget(m_playButton);
+    controlsLayout->addWidget(m_frameSlider, 1);
+    controlsLayout->addWidget(m_frameLabel);
+    controlsLayout->addWidget(m_fpsSpinBox);
+    controlsLayout->addWidget(m_exposureSpinBox);
+    controlsLayout->addWidget(m_statisticsLabel);
+
+    // The frames are painted above the controls
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addStretch(1);
+    layout->addWidget(m_controls);
+
+    // clang-format off
+    connect(m_player,          SIGNAL(frameChanged(int,QImage)),
+            this,              SLOT(onFrameChanged(int,QImage)));
+    connect(m_player,          SIGNAL(statisticsChanged(double,int)),
+            this,              SLOT(onStatisticsChanged(double,int)));
+    connect(m_playButton,      SIGNAL(clicked()),
+            this,              SLOT(togglePlayback()));
+    connect(m_frameSlider,     SIGNAL(sliderMoved(int)),
+            m_player,          SLOT(setFrame(int)));
+    connect(m_fpsSpinBox,      SIGNAL(valueChanged(double)),
+            m_player,          SLOT(setFps(double)));
+    connect(m_exposureSpinBox, SIGNAL(valueChanged(double)),
+            m_player,          SLOT(setExposure(double)));
+    // clang-format on
+}
+
+
+void SequenceWidget::togglePlayback()
+{
+    if (m_player->isPlaying()) {
+        m_player->pause();
+        m_playButton->setText(tr("Play"));
+    } else {
+        m_player->play();
+        m_playButton->setText(tr("Pause"));
+    }
+}
+
+
+void SequenceWidget::paintEvent(QPaintEvent*)
+{
+    QPainter painter(this);
+
+    const QRect area(0, 0, width(), m_controls->y());
+
+    painter.fillRect(area, Qt::black);
+
+    if (m_image.isNull() || area.isEmpty()) {
+        return;
+    }
+
+    // Fit the frame keeping its aspect ratio
+    QSize size = m_image.size();
+    size.scale(area.size(), Qt::KeepAspectRatio);
+
+    QRect target(QPoint(), size);
+    target.moveCenter(area.center());
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(target, m_image);
+}
+
+
+void SequenceWidget::keyPressEvent(QKeyEvent* e)
+{
+    const int nFrames = m_player->getSequence().size();
+    const int frame   = m_player->getCurrentFrame();
+
+    switch (e->key()) {
+        case Qt::Key_Space:
+            togglePlayback();
+            break;
+
+        case Qt::Key_Left:
+            m_player->setFrame((frame + nFrames - 1) % nFrames);
+            break;
+
+        case Qt::Key_Right:
+            m_player->setFrame((frame + 1) % nFrames);
+            break;
+
+        default:
+            QWidget::keyPressEvent(e);
+    }
+}
+
+
+void SequenceWidget::onFrameChanged(int index, const QImage& image)
+{
+    m_image = image;
+
+    m_frameLabel->setText(
+      QString::number(m_player->getSequence().getFrameNumber(index)));
+
+    if (!m_frameSlider->isSliderDown()) {
+        m_frameSlider->setValue(index);
+    }
+
+    update();
+}
+
+
+void SequenceWidget::onStatisticsChanged(double fps, int droppedFrames)
+{
+    m_statisticsLabel->setText(
+      tr("%1 fps, %2 dropped").arg(fps, 0, 'f', 1).arg(droppedFrames));
+}
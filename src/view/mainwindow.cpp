@@ -41,15 +41,29 @@
 #include <QFileInfo>
 #include <QMimeData>
 #include <QSettings>
+#include <QThread>
 
 #include <model/attribute/HeaderModel.h>
 #include <model/attribute/LayerItem.h>
+#include <model/SequencePlayer.h>
+#include <model/framebuffer/ChannelPlane.h>
+#include <model/framebuffer/ChannelPrefetcher.h>
+#include <model/framebuffer/MemoryManager.h>
+
+#include <util/ThreadPool.h>
 
 MainWindow::MainWindow(QWidget* parent)
   : QMainWindow(parent)
   , ui(new Ui::MainWindow)
   , m_openFileTabs(new QTabWidget(this))
   , m_statusBarMessage(new QLabel(this))
+  , m_threadCount(0)
+  , m_prefetchMemory(1024)
+  , m_sequenceMemory(2048)
+  , m_framebufferMemory(8192)
+  , m_decodeBackend("openexr")
+  , m_logDecodeTime(false)
+  , m_showProxy(true)
 {
     ui->setupUi(this);
     setAcceptDrops(true);
@@ -78,11 +92,11 @@ MainWindow::~MainWindow()
 }
 
 
-void MainWindow::open(std::istream& stream)
+void MainWindow::open(int fd)
 {
     //QString filename_no_path = QFileInfo(filename).fileName();
 
-    ImageFileWidget* fileWidget = new ImageFileWidget(stream, m_openFileTabs);
+    ImageFileWidget* fileWidget = new ImageFileWidget(fd, m_openFileTabs);
     fileWidget->setSplitterImageState(m_splitterImageState);
     fileWidget->setSplitterPropertiesState(m_splitterPropertiesState);
 
@@ -195,6 +209,14 @@ void MainWindow::writeSettings()
     settings.setValue("splitterImage", m_splitterImageState);
     settings.setValue("splitterProperties", m_splitterPropertiesState);
     settings.setValue("openedFolder", m_currentOpenedFolder);
+    settings.setValue("threadCount", m_threadCount);
+    settings.setValue("prefetchMemory", m_prefetchMemory);
+    settings.setValue("sequenceMemory", m_sequenceMemory);
+    settings.setValue("framebufferMemory", m_framebufferMemory);
+    settings.setValue("decodeBackend", m_decodeBackend);
+    settings.setValue("logDecodeTime", m_logDecodeTime);
+    settings.setValue("showProxy", m_showProxy);
+    settings.setValue("spillDirectory", m_spillDirectory);
     settings.endGroup();
 }
 
@@ -221,6 +243,41 @@ void MainWindow::readSettings()
         m_currentOpenedFolder = QDir::homePath();
     }
 
+    m_threadCount = settings.value("threadCount", 0).toInt();
+
+    ThreadPool::globalPool().setNumThreads(
+      m_threadCount > 0 ? m_threadCount : QThread::idealThreadCount());
+
+    m_prefetchMemory = settings.value("prefetchMemory", 1024).toInt();
+
+    ChannelPrefetcher::setMemoryBudget(
+      (size_t)qMax(0, m_prefetchMemory) << 20);
+
+    m_sequenceMemory = settings.value("sequenceMemory", 2048).toInt();
+
+    SequencePlayer::setMemoryBudget((size_t)qMax(0, m_sequenceMemory) << 20);
+
+    m_framebufferMemory = settings.value("framebufferMemory", 8192).toInt();
+
+    MemoryManager::global().setBudget(
+      (size_t)qMax(0, m_framebufferMemory) << 20);
+
+    m_decodeBackend = settings.value("decodeBackend", "openexr").toString();
+    m_logDecodeTime = settings.value("logDecodeTime", false).toBool();
+
+    FramebufferModel::setDecodeBackend(
+      m_decodeBackend == "core" ? FramebufferModel::Decode_OpenEXRCore
+                                : FramebufferModel::Decode_OpenEXR);
+    FramebufferModel::setDecodeTimeLogged(m_logDecodeTime);
+
+    m_showProxy = settings.value("showProxy", true).toBool();
+
+    FramebufferModel::setProxyShown(m_showProxy);
+
+    m_spillDirectory = settings.value("spillDirectory").toString();
+
+    ChannelPlane::setSpillDirectory(m_spillDirectory);
+
     settings.endGroup();
 }
 
@@ -235,6 +292,9 @@ void MainWindow::onTabCloseRequested(int idx)
     m_splitterPropertiesState = widget->getSplitterPropertiesState();
 
     m_openFileTabs->removeTab(idx);
+
+    // Also stops the loads of the file
+    delete widget;
 }
 
 
@@ -275,11 +335,19 @@ void MainWindow::on_action_Refresh_triggered()
 }
 
 
+void MainWindow::on_action_PlaySequence_triggered()
+{
+    ImageFileWidget* widget = (ImageFileWidget*)m_openFileTabs->currentWidget();
+    widget->openSequence();
+}
+
+
 void MainWindow::onCurrentChanged(int index)
 {
     if (index == -1) {
         // deactivate close and refresh functions
         ui->action_Refresh->setEnabled(false);
+        ui->action_PlaySequence->setEnabled(false);
         ui->action_Close->setEnabled(false);
         return;
     }
@@ -289,6 +357,8 @@ void MainWindow::onCurrentChanged(int index)
 
     ImageFileWidget* widget = (ImageFileWidget*)m_openFileTabs->currentWidget();
 
+    ui->action_PlaySequence->setEnabled(!widget->isStream());
+
     m_currentOpenedFolder     = widget->getOpenedFolder();
     m_splitterImageState      = widget->getSplitterImageState();
     m_splitterPropertiesState = widget->getSplitterPropertiesState();
@@ -61,7 +61,7 @@ class MainWindow: public QMainWindow
     ~MainWindow();
 
   public slots:
-    void open(std::istream& stream);
+    void open(int fd);
     void open(const QString& filename);
 
   private slots:
@@ -94,6 +94,8 @@ class MainWindow: public QMainWindow
 
     void on_action_Refresh_triggered();
 
+    void on_action_PlaySequence_triggered();
+
     void onCurrentChanged(int index);
 
     void on_action_Close_triggered();
@@ -109,4 +111,28 @@ class MainWindow: public QMainWindow
 
     QByteArray m_splitterImageState;
     QByteArray m_splitterPropertiesState;
+
+    // Number of worker threads, 0 to match the number of cores
+    int m_threadCount;
+
+    // Memory used to decode in advance the layers of an image, in MB
+    int m_prefetchMemory;
+
+    // Memory used by the decoded frames of a sequence, in MB
+    int m_sequenceMemory;
+
+    // Memory used by the pixels of the opened layers before the hidden ones
+    // are released, in MB
+    int m_framebufferMemory;
+
+    // API decoding the layers, "openexr" or "core"
+    QString m_decodeBackend;
+    bool    m_logDecodeTime;
+
+    // Large images are shown with a proxy while they are decoded
+    bool m_showProxy;
+
+    // Folder of the files backing the large planes, empty for the cache
+    // location
+    QString m_spillDirectory;
 };